@@ -0,0 +1,1168 @@
+/**
+ * @file luaz_heap_profile.c
+ * @brief Host tool: profile the heap use of Lua thread scripts.
+ *
+ * Runs each script in a Lua state set up like a luaz thread (minimal
+ * require(), preloaded libraries, GC parameters) under a counting allocator.
+ * A stub `zephyr` library stands in for the target bindings
+ * (scripts/luaz_check_stubs.py keeps its method lists in sync).  Time is
+ * virtual: msleep, zephyr.run and zbus timeouts advance a clock instead of
+ * blocking.  The peak heap use of each script is written as a Kconfig
+ * fragment with suggested <NAME>_LUA_THREAD_HEAP_SIZE values.
+ *
+ * Usage:
+ *   luaz_heap_profile [-o file] [-m margin] [-r round] [-t ms] [-i count]
+ *                     [[script options] script.lua]...
+ *
+ * Global options:
+ *   -o file    Write the fragment to file instead of stdout.
+ *   -m margin  Safety margin added to the peak, in percent (default 25).
+ *   -r round   Round suggestions up to a multiple of round bytes (default 1024).
+ *   -t ms      Stop a script after this much virtual time (default 10000).
+ *   -i count   Stop a script after count million VM instructions (default 50).
+ *   -v         Echo printk/log output of the scripts to stderr.
+ *
+ * Script options apply to every script that follows them, except -n and -L:
+ *   -n name    Thread name of the next script (default: its file name
+ *              without extension).
+ *   -L dir     Directory of the functions split out of the next script by
+ *              luaz_gen.py --lazy: require() loads a module "a:b" missing
+ *              from package.preload from dir/a.b.lua, in the script's
+ *              loading mode, as the target loads it from the lazy bundle.
+ *   -s         Run the script from source (default).
+ *   -b         Run the script as stripped bytecode, copied into the heap.
+ *   -B         Run the script as stripped bytecode, in place (lua_load "B").
+ *   -l libs    Comma-separated libraries to preload (base, string, table,
+ *              math, coroutine, utf8, debug, or none; default: all).
+ *   -g         Generational GC.
+ *   -G         Incremental GC (default).
+ *   -p pause   GC pause, percent (0 = Lua default).
+ *   -k stepmul GC step multiplier, percent (0 = Lua default).
+ *   -z size    GC step size, bytes (0 = Lua default).
+ *
+ * A script stopped by the time or instruction limit counts as finished;
+ * a script raising an error makes the tool fail.
+ *
+ * Peaks are measured with host object sizes: on a 64-bit host pointers are
+ * twice as wide as on the target, so the estimate is an upper bound.  The
+ * sys_heap column adds the chunk header and 8-byte rounding of every block.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+/** @brief sys_heap allocation unit and block alignment, in bytes. */
+#define SYS_HEAP_CHUNK 8
+/** @brief sys_heap chunk header of heaps smaller than 256 KB, in bytes. */
+#define SYS_HEAP_HDR 4
+/** @brief Fixed sys_heap bookkeeping (struct z_heap and free buckets), in bytes. */
+#define SYS_HEAP_OVERHEAD 256
+/** @brief VM instructions between two instruction-limit checks. */
+#define HOOK_COUNT 1000
+/** @brief Alignment of bytecode run in place (LUAZ_BYTECODE_ALIGN). */
+#define BYTECODE_ALIGN 8
+
+/** @brief Library bits for -l. */
+enum {
+	LIB_BASE = 1 << 0,
+	LIB_STRING = 1 << 1,
+	LIB_TABLE = 1 << 2,
+	LIB_MATH = 1 << 3,
+	LIB_COROUTINE = 1 << 4,
+	LIB_UTF8 = 1 << 5,
+	LIB_DEBUG = 1 << 6,
+	LIB_ALL = (1 << 7) - 1,
+};
+
+/** @brief Loading mode of a script. */
+enum load_mode {
+	LOAD_SOURCE,
+	LOAD_BYTECODE,
+	LOAD_IN_PLACE,
+};
+
+/** @brief Options applying to the scripts that follow them. */
+struct script_opts {
+	const char *name;
+	const char *lazy_dir;
+	enum load_mode mode;
+	unsigned int libs;
+	bool generational;
+	int pause;
+	int stepmul;
+	int stepsize;
+};
+
+/** @brief Counting allocator state of one profiled Lua state. */
+struct profile {
+	/** Bytes Lua holds (requested sizes). */
+	size_t lua_in_use;
+	size_t lua_peak;
+	/** Bytes the same blocks would take in a sys_heap. */
+	size_t heap_in_use;
+	size_t heap_peak;
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long reallocs;
+	unsigned long failures;
+	/** zephyr.mem_limit() limit; 0 for none. */
+	size_t limit;
+};
+
+/** @brief Virtual clock and run limits of the script being profiled. */
+struct run {
+	uint64_t now_ms;
+	uint64_t time_limit_ms;
+	unsigned long hooks;
+	unsigned long max_hooks;
+	/** Set when a limit stopped the script. */
+	bool stopped;
+	bool verbose;
+	/** -L directory and loading mode of the script, for require(). */
+	const char *lazy_dir;
+	enum load_mode mode;
+	/** Bytecode of the loaded lazy modules, freed after lua_close(). */
+	unsigned char *lazy_code[64];
+	size_t lazy_count;
+};
+
+static const char *progname = "luaz_heap_profile";
+static struct run run;
+
+static void fatal(const char *fmt, const char *arg)
+{
+	fprintf(stderr, "%s: ", progname);
+	fprintf(stderr, fmt, arg);
+	fputc('\n', stderr);
+	exit(EXIT_FAILURE);
+}
+
+/* ---- Allocator ---------------------------------------------------------- */
+
+/** @brief Size of a block of @p n bytes in a sys_heap. */
+static size_t chunk_bytes(size_t n)
+{
+	if (n == 0) {
+		return 0;
+	}
+
+	return (n + SYS_HEAP_HDR + SYS_HEAP_CHUNK - 1) & ~(size_t)(SYS_HEAP_CHUNK - 1);
+}
+
+static void *profile_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	struct profile *p = ud;
+	size_t old = ptr != NULL ? osize : 0;
+
+	if (nsize == 0) {
+		free(ptr);
+		if (ptr != NULL) {
+			p->frees++;
+		}
+		p->lua_in_use -= old;
+		p->heap_in_use -= chunk_bytes(old);
+
+		return NULL;
+	}
+
+	if (p->limit != 0 && nsize > old && p->lua_in_use - old + nsize > p->limit) {
+		p->failures++;
+		return NULL;
+	}
+
+	void *block = realloc(ptr, nsize);
+
+	if (block == NULL) {
+		p->failures++;
+		return NULL;
+	}
+
+	if (ptr == NULL) {
+		p->allocs++;
+	} else {
+		p->reallocs++;
+	}
+
+	p->lua_in_use += nsize - old;
+	p->heap_in_use += chunk_bytes(nsize) - chunk_bytes(old);
+	if (p->lua_in_use > p->lua_peak) {
+		p->lua_peak = p->lua_in_use;
+	}
+	if (p->heap_in_use > p->heap_peak) {
+		p->heap_peak = p->heap_in_use;
+	}
+
+	return block;
+}
+
+static struct profile *state_profile(lua_State *L)
+{
+	void *ud;
+
+	lua_getallocf(L, &ud);
+
+	return ud;
+}
+
+/* ---- Virtual time and limits -------------------------------------------- */
+
+/** @brief Stop the running script; the profile so far counts as complete. */
+static int stop(lua_State *L, const char *why)
+{
+	run.stopped = true;
+
+	return luaL_error(L, "stopped: %s", why);
+}
+
+/** @brief Advance the virtual clock by @p ms; a negative value waits forever. */
+static void advance(lua_State *L, lua_Integer ms)
+{
+	if (ms < 0) {
+		stop(L, "waits forever");
+	}
+
+	run.now_ms += (uint64_t)ms;
+	if (run.now_ms > run.time_limit_ms) {
+		stop(L, "time limit");
+	}
+}
+
+static void count_hook(lua_State *L, lua_Debug *ar)
+{
+	(void)ar;
+
+	if (++run.hooks > run.max_hooks) {
+		stop(L, "instruction limit");
+	}
+}
+
+/* ---- Stub zephyr library ------------------------------------------------ */
+
+static int z_msleep(lua_State *L)
+{
+	advance(L, luaL_checkinteger(L, 1));
+
+	return 0;
+}
+
+static int z_uptime_ms(lua_State *L)
+{
+	lua_pushinteger(L, (lua_Integer)run.now_ms);
+
+	return 1;
+}
+
+static int z_gc_step_budget(lua_State *L)
+{
+	luaL_argcheck(L, luaL_checkinteger(L, 1) > 0, 1, "budget out of range");
+
+	lua_pushboolean(L, lua_gc(L, LUA_GCSTEP, 0));
+	lua_pushinteger(L, 1);
+
+	return 2;
+}
+
+static int z_idle_gc_stats(lua_State *L)
+{
+	lua_pushinteger(L, 0);
+	lua_pushinteger(L, 0);
+	lua_pushinteger(L, 0);
+
+	return 3;
+}
+
+static int z_mem_stats(lua_State *L)
+{
+	struct profile *p = state_profile(L);
+	static const char *const types[] = {"string", "table",  "function",
+					    "userdata", "thread", "other"};
+
+	lua_createtable(L, 0, 9);
+	lua_pushinteger(L, (lua_Integer)p->allocs);
+	lua_setfield(L, -2, "allocs");
+	lua_pushinteger(L, (lua_Integer)p->frees);
+	lua_setfield(L, -2, "frees");
+	lua_pushinteger(L, (lua_Integer)p->reallocs);
+	lua_setfield(L, -2, "reallocs");
+	lua_pushinteger(L, (lua_Integer)p->failures);
+	lua_setfield(L, -2, "failures");
+	lua_pushinteger(L, (lua_Integer)p->lua_in_use);
+	lua_setfield(L, -2, "in_use");
+	lua_pushinteger(L, (lua_Integer)p->lua_peak);
+	lua_setfield(L, -2, "peak");
+	lua_pushinteger(L, 0);
+	lua_setfield(L, -2, "size");
+
+	lua_createtable(L, 16, 0);
+	for (int i = 1; i <= 16; i++) {
+		lua_pushinteger(L, 0);
+		lua_rawseti(L, -2, i);
+	}
+	lua_setfield(L, -2, "hist");
+
+	lua_createtable(L, 0, 6);
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		lua_pushinteger(L, 0);
+		lua_setfield(L, -2, types[i]);
+	}
+	lua_setfield(L, -2, "types");
+
+	return 1;
+}
+
+static int z_mem_limit(lua_State *L)
+{
+	struct profile *p = state_profile(L);
+
+	if (!lua_isnoneornil(L, 1)) {
+		p->limit = (size_t)luaL_checkinteger(L, 1);
+	}
+
+	lua_pushinteger(L, (lua_Integer)p->limit);
+	lua_pushinteger(L, (lua_Integer)p->lua_in_use);
+	lua_pushboolean(L, 0);
+
+	return 3;
+}
+
+static int z_run(lua_State *L)
+{
+	advance(L, luaL_optinteger(L, 1, -1));
+	lua_pushinteger(L, 0);
+
+	return 1;
+}
+
+static int z_print(lua_State *L)
+{
+	const char *msg = luaL_checkstring(L, 1);
+
+	if (run.verbose) {
+		fprintf(stderr, "%s\n", msg);
+	}
+
+	return 0;
+}
+
+/* ---- Stub zbus library -------------------------------------------------- */
+
+#define STUB_CHAN "luaz_profile.chan"
+#define STUB_OBS  "luaz_profile.obs"
+#define STUB_VIEW "luaz_profile.view"
+
+/** @brief Timeout error the stubs return when nothing was published. */
+#define STUB_EAGAIN (-11)
+
+/**
+ * @brief Push a copy of the table at @p idx, as decoding a message would:
+ *        missing keys come from its __index tables, never from functions.
+ */
+static void copy_table(lua_State *L, int idx)
+{
+	int copy;
+
+	idx = lua_absindex(L, idx);
+	lua_newtable(L);
+	copy = lua_gettop(L);
+
+	/* The table, then its __index defaults tables, as the target decodes it */
+	lua_pushvalue(L, idx);
+	for (int i = 0; i <= 4; i++) {
+		int src = lua_gettop(L);
+
+		lua_pushnil(L);
+		while (lua_next(L, src) != 0) {
+			lua_pushvalue(L, -2);
+			if (lua_rawget(L, copy) != LUA_TNIL) {
+				lua_pop(L, 2);
+				continue;
+			}
+			lua_pop(L, 1);
+			lua_pushvalue(L, -2);
+			if (lua_type(L, -2) == LUA_TTABLE) {
+				copy_table(L, -2);
+			} else {
+				lua_pushvalue(L, -2);
+			}
+			lua_rawset(L, copy);
+			lua_pop(L, 1);
+		}
+
+		if (!lua_getmetatable(L, src)) {
+			break;
+		}
+		lua_pushliteral(L, "__index");
+		if (lua_rawget(L, -2) != LUA_TTABLE) {
+			lua_pop(L, 2);
+			break;
+		}
+		lua_remove(L, -2);
+		lua_remove(L, -2);
+	}
+	lua_settop(L, copy);
+}
+
+static int chan_declare(lua_State *L)
+{
+	luaL_checkstring(L, 1);
+	lua_newuserdatauv(L, 1, 1);
+	luaL_setmetatable(L, STUB_CHAN);
+
+	return 1;
+}
+
+static int obs_declare(lua_State *L)
+{
+	luaL_checkstring(L, 1);
+	lua_newuserdatauv(L, 1, 0);
+	luaL_setmetatable(L, STUB_OBS);
+
+	return 1;
+}
+
+/**
+ * @brief Push a view: a userdata whose fields live in a table user value,
+ *        seeded with a copy of the table at @p idx (or empty for 0).
+ */
+static void push_view(lua_State *L, int idx)
+{
+	idx = idx != 0 ? lua_absindex(L, idx) : 0;
+	lua_newuserdatauv(L, 1, 1);
+	luaL_setmetatable(L, STUB_VIEW);
+	if (idx != 0) {
+		copy_table(L, idx);
+	} else {
+		lua_newtable(L);
+	}
+	lua_setiuservalue(L, -2, 1);
+}
+
+/** @brief Store a copy of the message at @p idx (table or view) as the last published. */
+static void store_msg(lua_State *L, int idx)
+{
+	idx = lua_absindex(L, idx);
+	if (luaL_testudata(L, idx, STUB_VIEW) != NULL) {
+		lua_getiuservalue(L, idx, 1);
+		copy_table(L, -1);
+		lua_setiuservalue(L, 1, 1);
+		lua_pop(L, 1);
+	} else if (lua_type(L, idx) == LUA_TTABLE) {
+		copy_table(L, idx);
+		lua_setiuservalue(L, 1, 1);
+	}
+}
+
+static int chan_pub(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_CHAN);
+	store_msg(L, 2);
+	lua_pushinteger(L, 0);
+
+	return 1;
+}
+
+static int chan_pub_many(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_CHAN);
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	lua_Integer n = luaL_len(L, 2);
+
+	for (lua_Integer i = 1; i <= n; i++) {
+		if (lua_rawgeti(L, 2, i) != LUA_TTABLE && luaL_testudata(L, -1, STUB_VIEW) == NULL) {
+			return luaL_error(L, "element %d is not a table or a valid view of "
+					  "this message type", (int)i);
+		}
+		lua_pop(L, 1);
+	}
+	if (n > 0) {
+		lua_rawgeti(L, 2, n);
+		store_msg(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_pushinteger(L, n);
+	lua_pushinteger(L, 0);
+
+	return 2;
+}
+
+static int chan_read(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_CHAN);
+	if (lua_getiuservalue(L, 1, 1) != LUA_TTABLE) {
+		lua_pushinteger(L, STUB_EAGAIN);
+		lua_pushnil(L);
+		return 2;
+	}
+	lua_pushinteger(L, 0);
+	copy_table(L, -2);
+
+	return 2;
+}
+
+static int chan_read_into(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_CHAN);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	lua_pushinteger(L, lua_getiuservalue(L, 1, 1) == LUA_TTABLE ? 0 : STUB_EAGAIN);
+	lua_pushvalue(L, 2);
+
+	return 2;
+}
+
+static int chan_view(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_CHAN);
+	luaL_checkinteger(L, 2);
+	lua_settop(L, 3);
+	if (lua_getiuservalue(L, 1, 1) != LUA_TTABLE) {
+		lua_pushinteger(L, STUB_EAGAIN);
+		lua_pushnil(L);
+		return 2;
+	}
+	lua_pushinteger(L, 0);
+	if (lua_isnil(L, 3)) {
+		push_view(L, 4);
+	} else {
+		luaL_checkudata(L, 3, STUB_VIEW);
+		copy_table(L, 4);
+		lua_setiuservalue(L, 3, 1);
+		lua_pushvalue(L, 3);
+	}
+
+	return 2;
+}
+
+static int chan_with_claim(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_CHAN);
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+	lua_settop(L, 3);
+	lua_pushinteger(L, 0);
+	lua_insert(L, 3);
+	if (lua_getiuservalue(L, 1, 1) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+	}
+	lua_call(L, 1, LUA_MULTRET);
+
+	return lua_gettop(L) - 2;
+}
+
+/** @brief Observer waits: nothing is ever published to the profiled script. */
+static int obs_wait(lua_State *L, int nret)
+{
+	luaL_checkudata(L, 1, STUB_OBS);
+	advance(L, luaL_checkinteger(L, nret == 3 ? 2 : 3));
+	lua_pushinteger(L, STUB_EAGAIN);
+	for (int i = 1; i < nret; i++) {
+		lua_pushnil(L);
+	}
+
+	return nret;
+}
+
+static int obs_wait_msg(lua_State *L)
+{
+	return obs_wait(L, 3);
+}
+
+static int obs_wait_msg_into(lua_State *L)
+{
+	lua_settop(L, 3);
+	obs_wait(L, 2);
+	lua_pushvalue(L, 2);
+
+	return 3;
+}
+
+static int obs_drain(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_OBS);
+	advance(L, luaL_checkinteger(L, 3));
+	lua_pushinteger(L, STUB_EAGAIN);
+	lua_pushinteger(L, 0);
+	if (lua_type(L, 4) == LUA_TTABLE) {
+		lua_pushvalue(L, 4);
+	} else {
+		lua_newtable(L);
+	}
+
+	return 3;
+}
+
+static int view_index(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_VIEW);
+	lua_getiuservalue(L, 1, 1);
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+
+	return 1;
+}
+
+static int view_newindex(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_VIEW);
+	lua_getiuservalue(L, 1, 1);
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, 3);
+	lua_rawset(L, -3);
+
+	return 0;
+}
+
+static int view_tostring(lua_State *L)
+{
+	lua_pushfstring(L, "zbus_view { %p }", luaL_checkudata(L, 1, STUB_VIEW));
+
+	return 1;
+}
+
+static int zbus_listen(lua_State *L)
+{
+	luaL_checkudata(L, 1, STUB_CHAN);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_pushinteger(L, 0);
+
+	return 1;
+}
+
+static const luaL_Reg chan_methods[] = {
+	{"pub", chan_pub},
+	{"pub_many", chan_pub_many},
+	{"read", chan_read},
+	{"read_into", chan_read_into},
+	{"view", chan_view},
+	{"with_claim", chan_with_claim},
+	{NULL, NULL},
+};
+
+static const luaL_Reg view_metamethods[] = {
+	{"__index", view_index},
+	{"__newindex", view_newindex},
+	{"__tostring", view_tostring},
+	{NULL, NULL},
+};
+
+static const luaL_Reg obs_methods[] = {
+	{"wait_msg", obs_wait_msg},
+	{"wait_msg_into", obs_wait_msg_into},
+	{"drain", obs_drain},
+	{NULL, NULL},
+};
+
+static const luaL_Reg zbus_lib[] = {
+	{"channel_declare", chan_declare},
+	{"observer_declare", obs_declare},
+	{"listen", zbus_listen},
+	{NULL, NULL},
+};
+
+static const luaL_Reg zephyr_lib[] = {
+	{"msleep", z_msleep},
+	{"uptime_ms", z_uptime_ms},
+	{"gc_step_budget", z_gc_step_budget},
+	{"idle_gc_stats", z_idle_gc_stats},
+	{"mem_stats", z_mem_stats},
+	{"mem_limit", z_mem_limit},
+	{"run", z_run},
+	{"printk", z_print},
+	{"log_inf", z_print},
+	{"log_wrn", z_print},
+	{"log_dbg", z_print},
+	{"log_err", z_print},
+	{NULL, NULL},
+};
+
+static void new_class(lua_State *L, const char *name, const luaL_Reg *methods)
+{
+	luaL_newmetatable(L, name);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	luaL_setfuncs(L, methods, 0);
+	lua_pop(L, 1);
+}
+
+static int open_zephyr(lua_State *L)
+{
+	new_class(L, STUB_CHAN, chan_methods);
+	new_class(L, STUB_OBS, obs_methods);
+	luaL_newmetatable(L, STUB_VIEW);
+	luaL_setfuncs(L, view_metamethods, 0);
+	lua_pop(L, 1);
+
+	luaL_newlib(L, zephyr_lib);
+	luaL_newlib(L, zbus_lib);
+	lua_setfield(L, -2, "zbus");
+
+	return 1;
+}
+
+/* ---- State setup, as luaz_openlibs() ------------------------------------ */
+
+static unsigned char *compile(const char *path, size_t *len);
+
+/**
+ * @brief Push the lazy module @p name from the -L directory as a function.
+ *
+ * @return false, with nothing pushed, when the directory has no such file.
+ */
+static bool load_lazy(lua_State *L, const char *name)
+{
+	char path[512];
+	size_t code_len;
+	unsigned char *code;
+	FILE *f;
+	int rc;
+
+	if (run.lazy_dir == NULL ||
+	    snprintf(path, sizeof(path), "%s/%s.lua", run.lazy_dir, name) >= (int)sizeof(path)) {
+		return false;
+	}
+	for (char *c = path + strlen(run.lazy_dir) + 1; *c != '\0'; c++) {
+		if (*c == ':') {
+			*c = '.';
+		}
+	}
+	f = fopen(path, "r");
+	if (f == NULL) {
+		return false;
+	}
+	fclose(f);
+
+	if (run.mode == LOAD_SOURCE) {
+		rc = luaL_loadfile(L, path);
+	} else {
+		if (run.lazy_count == sizeof(run.lazy_code) / sizeof(run.lazy_code[0])) {
+			fatal("too many lazy modules loaded by %s", name);
+		}
+		code = compile(path, &code_len);
+		run.lazy_code[run.lazy_count++] = code;
+		rc = luaL_loadbufferx(L, (const char *)code, code_len, name,
+				      run.mode == LOAD_IN_PLACE ? "B" : "b");
+	}
+	if (rc != LUA_OK) {
+		lua_error(L);
+	}
+
+	return true;
+}
+
+/** @brief require() limited to package.preload, as on the target. */
+static int preload_require(lua_State *L)
+{
+	const char *name = luaL_checkstring(L, 1);
+
+	lua_settop(L, 1);
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+	if (lua_getfield(L, 2, name) != LUA_TNIL) {
+		return 1;
+	}
+	lua_pop(L, 1);
+
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+	if (lua_getfield(L, 3, name) == LUA_TNIL) {
+		lua_pop(L, 1);
+		if (!load_lazy(L, name)) {
+			return luaL_error(L, "module '%s' not found", name);
+		}
+	}
+	lua_pushvalue(L, 1);
+	lua_call(L, 1, 1);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_pushboolean(L, 1);
+	}
+	lua_pushvalue(L, -1);
+	lua_setfield(L, 2, name);
+
+	return 1;
+}
+
+static const struct {
+	const char *name;
+	unsigned int bit;
+	lua_CFunction open;
+} libs[] = {
+	{"string", LIB_STRING, luaopen_string},
+	{"table", LIB_TABLE, luaopen_table},
+	{"math", LIB_MATH, luaopen_math},
+	{"coroutine", LIB_COROUTINE, luaopen_coroutine},
+	{"utf8", LIB_UTF8, luaopen_utf8},
+	{"debug", LIB_DEBUG, luaopen_debug},
+};
+
+static void open_libs(lua_State *L, unsigned int mask)
+{
+	lua_pushcfunction(L, preload_require);
+	lua_setglobal(L, "require");
+
+	if (mask & LIB_BASE) {
+		luaL_requiref(L, LUA_GNAME, luaopen_base, 1);
+		lua_pop(L, 1);
+	}
+
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+	lua_pushcfunction(L, open_zephyr);
+	lua_setfield(L, -2, "zephyr");
+	for (size_t i = 0; i < sizeof(libs) / sizeof(libs[0]); i++) {
+		if (mask & libs[i].bit) {
+			lua_pushcfunction(L, libs[i].open);
+			lua_setfield(L, -2, libs[i].name);
+		}
+	}
+	lua_pop(L, 1);
+}
+
+static unsigned int parse_libs(const char *list)
+{
+	unsigned int mask = 0;
+
+	if (strcmp(list, "none") == 0) {
+		return 0;
+	}
+
+	while (*list != '\0') {
+		size_t len = strcspn(list, ",");
+		bool found = len == 4 && strncmp(list, "base", 4) == 0;
+
+		if (found) {
+			mask |= LIB_BASE;
+		}
+		for (size_t i = 0; !found && i < sizeof(libs) / sizeof(libs[0]); i++) {
+			if (strlen(libs[i].name) == len && strncmp(list, libs[i].name, len) == 0) {
+				mask |= libs[i].bit;
+				found = true;
+			}
+		}
+		if (!found) {
+			fatal("unknown library in '%s'", list);
+		}
+		list += len;
+		if (*list == ',') {
+			list++;
+		}
+	}
+
+	return mask;
+}
+
+/* ---- Bytecode ----------------------------------------------------------- */
+
+struct dump_buf {
+	unsigned char *data;
+	size_t len;
+	size_t cap;
+};
+
+static int dump_writer(lua_State *L, const void *p, size_t sz, void *ud)
+{
+	struct dump_buf *b = ud;
+
+	(void)L;
+	if (b->len + sz > b->cap) {
+		size_t cap = b->cap != 0 ? b->cap : 4096;
+
+		while (cap < b->len + sz) {
+			cap *= 2;
+		}
+		b->data = realloc(b->data, cap);
+		if (b->data == NULL) {
+			return 1;
+		}
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, p, sz);
+	b->len += sz;
+
+	return 0;
+}
+
+/**
+ * @brief Compile @p path to stripped bytecode, as luac -s does.
+ *
+ * Compiled in a separate state so that parser memory does not count.  The
+ * result is aligned to BYTECODE_ALIGN, like the embedded arrays.
+ */
+static unsigned char *compile(const char *path, size_t *len)
+{
+	lua_State *C = luaL_newstate();
+	struct dump_buf b = {0};
+	unsigned char *aligned;
+
+	if (C == NULL) {
+		fatal("%s", "cannot create state");
+	}
+	if (luaL_loadfile(C, path) != LUA_OK) {
+		fatal("%s", lua_tostring(C, -1));
+	}
+	if (lua_dump(C, dump_writer, &b, 1) != 0 || b.data == NULL) {
+		fatal("cannot dump %s", path);
+	}
+	lua_close(C);
+
+	aligned = aligned_alloc(BYTECODE_ALIGN,
+				(b.len + BYTECODE_ALIGN - 1) & ~(size_t)(BYTECODE_ALIGN - 1));
+	if (aligned == NULL) {
+		fatal("%s", strerror(errno));
+	}
+	memcpy(aligned, b.data, b.len);
+	free(b.data);
+	*len = b.len;
+
+	return aligned;
+}
+
+/* ---- Profiling ---------------------------------------------------------- */
+
+/** @brief Thread name of a script: its file name without extension. */
+static void thread_name(const char *path, char *out, size_t size)
+{
+	const char *base = strrchr(path, '/');
+	size_t len;
+
+	base = base != NULL ? base + 1 : path;
+	len = strcspn(base, ".");
+	if (len >= size) {
+		len = size - 1;
+	}
+	memcpy(out, base, len);
+	out[len] = '\0';
+}
+
+/** @brief Run one script and record its heap profile in @p p. */
+static void profile_script(const char *path, const struct script_opts *o, struct profile *p)
+{
+	unsigned char *code = NULL;
+	size_t code_len = 0;
+	int rc;
+
+	if (o->mode != LOAD_SOURCE) {
+		code = compile(path, &code_len);
+	}
+
+	memset(p, 0, sizeof(*p));
+	run.now_ms = 0;
+	run.hooks = 0;
+	run.stopped = false;
+	run.lazy_dir = o->lazy_dir;
+	run.mode = o->mode;
+	run.lazy_count = 0;
+
+	lua_State *L = lua_newstate(profile_alloc, p, 0);
+
+	if (L == NULL) {
+		fatal("%s", "cannot create state");
+	}
+
+	open_libs(L, o->libs);
+	lua_gc(L, o->generational ? LUA_GCGEN : LUA_GCINC);
+	if (o->pause > 0) {
+		lua_gc(L, LUA_GCPARAM, LUA_GCPPAUSE, o->pause);
+	}
+	if (o->stepmul > 0) {
+		lua_gc(L, LUA_GCPARAM, LUA_GCPSTEPMUL, o->stepmul);
+	}
+	if (o->stepsize > 0) {
+		lua_gc(L, LUA_GCPARAM, LUA_GCPSTEPSIZE, o->stepsize);
+	}
+	lua_sethook(L, count_hook, LUA_MASKCOUNT, HOOK_COUNT);
+
+	if (o->mode == LOAD_SOURCE) {
+		rc = luaL_loadfile(L, path);
+	} else {
+		rc = luaL_loadbufferx(L, (const char *)code, code_len, path,
+				      o->mode == LOAD_IN_PLACE ? "B" : "b");
+	}
+	if (rc == LUA_OK) {
+		rc = lua_pcall(L, 0, 0, 0);
+	}
+	if (rc != LUA_OK && !run.stopped) {
+		fprintf(stderr, "%s: %s: %s\n", progname, path, lua_tostring(L, -1));
+		exit(EXIT_FAILURE);
+	}
+
+	lua_close(L);
+	free(code);
+	for (size_t i = 0; i < run.lazy_count; i++) {
+		free(run.lazy_code[i]);
+	}
+}
+
+static size_t suggest(size_t peak, unsigned int margin, size_t round)
+{
+	size_t size = peak + SYS_HEAP_OVERHEAD;
+
+	size += size * margin / 100;
+
+	return (size + round - 1) / round * round;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: %s [-o file] [-m margin] [-r round] [-t ms] [-i count] [-v]\n"
+		"       [[-n name] [-L dir] [-s|-b|-B] [-l libs] [-g|-G] [-p pause] [-k stepmul] [-z size]"
+		" script.lua]...\n",
+		progname);
+	exit(EXIT_FAILURE);
+}
+
+static long num_arg(int argc, char **argv, int *i)
+{
+	char *end;
+	long v;
+
+	if (++*i >= argc) {
+		usage();
+	}
+	v = strtol(argv[*i], &end, 0);
+	if (*end != '\0' || v < 0) {
+		fatal("invalid number '%s'", argv[*i]);
+	}
+
+	return v;
+}
+
+int main(int argc, char **argv)
+{
+	struct script_opts o = {.mode = LOAD_SOURCE, .libs = LIB_ALL};
+	const char *out_path = NULL;
+	unsigned int margin = 25;
+	size_t round = 1024;
+	FILE *out = stdout;
+	int scripts = 0;
+
+	run.time_limit_ms = 10000;
+	run.max_hooks = 50000000 / HOOK_COUNT;
+
+	if (argv[0] != NULL && argv[0][0] != '\0') {
+		progname = argv[0];
+	}
+
+	/* Global options first, so the output file is known before any script runs */
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-o") == 0) {
+			if (++i >= argc) {
+				usage();
+			}
+			out_path = argv[i];
+		} else if (strcmp(argv[i], "-m") == 0) {
+			margin = (unsigned int)num_arg(argc, argv, &i);
+		} else if (strcmp(argv[i], "-r") == 0) {
+			round = (size_t)num_arg(argc, argv, &i);
+		} else if (strcmp(argv[i], "-t") == 0) {
+			run.time_limit_ms = (uint64_t)num_arg(argc, argv, &i);
+		} else if (strcmp(argv[i], "-i") == 0) {
+			run.max_hooks = (unsigned long)num_arg(argc, argv, &i) * 1000000 / HOOK_COUNT;
+		} else if (strcmp(argv[i], "-v") == 0) {
+			run.verbose = true;
+		} else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-L") == 0 ||
+			   strcmp(argv[i], "-l") == 0 ||
+			   strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "-k") == 0 ||
+			   strcmp(argv[i], "-z") == 0) {
+			i++;
+		}
+	}
+	if (round == 0) {
+		usage();
+	}
+
+	if (out_path != NULL) {
+		out = fopen(out_path, "w");
+		if (out == NULL) {
+			fatal("cannot open %s", out_path);
+		}
+	}
+
+	fprintf(out, "# Generated by luaz_heap_profile: peak + %u%% margin, rounded to %zu B.\n",
+		margin, round);
+	fprintf(out, "# Measured with %zu-bit host pointers.\n", sizeof(void *) * 8);
+
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (strcmp(arg, "-o") == 0 || strcmp(arg, "-m") == 0 || strcmp(arg, "-r") == 0 ||
+		    strcmp(arg, "-t") == 0 || strcmp(arg, "-i") == 0) {
+			i++;
+		} else if (strcmp(arg, "-v") == 0) {
+			continue;
+		} else if (strcmp(arg, "-n") == 0) {
+			if (++i >= argc) {
+				usage();
+			}
+			o.name = argv[i];
+		} else if (strcmp(arg, "-L") == 0) {
+			if (++i >= argc) {
+				usage();
+			}
+			o.lazy_dir = argv[i];
+		} else if (strcmp(arg, "-s") == 0) {
+			o.mode = LOAD_SOURCE;
+		} else if (strcmp(arg, "-b") == 0) {
+			o.mode = LOAD_BYTECODE;
+		} else if (strcmp(arg, "-B") == 0) {
+			o.mode = LOAD_IN_PLACE;
+		} else if (strcmp(arg, "-l") == 0) {
+			if (++i >= argc) {
+				usage();
+			}
+			o.libs = parse_libs(argv[i]);
+		} else if (strcmp(arg, "-g") == 0) {
+			o.generational = true;
+		} else if (strcmp(arg, "-G") == 0) {
+			o.generational = false;
+		} else if (strcmp(arg, "-p") == 0) {
+			o.pause = (int)num_arg(argc, argv, &i);
+		} else if (strcmp(arg, "-k") == 0) {
+			o.stepmul = (int)num_arg(argc, argv, &i);
+		} else if (strcmp(arg, "-z") == 0) {
+			o.stepsize = (int)num_arg(argc, argv, &i);
+		} else if (arg[0] == '-') {
+			usage();
+		} else {
+			struct profile p;
+			char name[64];
+
+			if (o.name != NULL) {
+				snprintf(name, sizeof(name), "%s", o.name);
+				o.name = NULL;
+			} else {
+				thread_name(arg, name, sizeof(name));
+			}
+
+			profile_script(arg, &o, &p);
+			o.lazy_dir = NULL;
+
+			fprintf(out, "\n# %s: peak %zu B Lua, %zu B sys_heap, %lu allocs%s\n", name,
+				p.lua_peak, p.heap_peak, p.allocs,
+				run.stopped ? " (stopped by limit)" : "");
+			for (char *c = name; *c != '\0'; c++) {
+				*c = (char)toupper((unsigned char)*c);
+			}
+			fprintf(out, "CONFIG_%s_LUA_THREAD_HEAP_SIZE=%zu\n", name,
+				suggest(p.heap_peak, margin, round));
+			scripts++;
+		}
+	}
+
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	if (scripts == 0) {
+		usage();
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file luaz_bundle.h
+ * @brief Bytecode module archives searched by require() (CONFIG_LUA_BUNDLE).
+ *
+ * luaz_add_bundle() packs pre-compiled modules into one archive per call:
+ *
+ *   "LZB\x01", module count (u32 LE), then one index entry per module,
+ *   sorted by name: name offset, chunk offset, chunk length (u32 LE each,
+ *   from the start of the archive).  Names are NUL-terminated; chunks are
+ *   aligned to LUAZ_BYTECODE_ALIGN and stored once when several modules
+ *   compile to the same bytecode.
+ *
+ * require() binary-searches the index of every linked bundle after
+ * package.preload, and loads a module only when it is first required.
+ */
+
+#ifndef _LUAZ_BUNDLE_H
+#define _LUAZ_BUNDLE_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <zephyr/sys/iterable_sections.h>
+#include <zephyr/sys/util.h>
+
+/** @brief A bundle archive linked into the firmware. */
+struct luaz_bundle {
+	/** Archive, aligned to LUAZ_BYTECODE_ALIGN. */
+	const uint8_t *data;
+	/** Size of @ref data in bytes. */
+	size_t len;
+};
+
+/**
+ * @brief Register a bundle archive with require().
+ *
+ * Used by the sources that luaz_add_bundle() generates.
+ *
+ * @param _name  Bundle name.
+ * @param _data  Archive array.
+ * @param _len   Archive size in bytes.
+ */
+#define LUAZ_BUNDLE_DEFINE(_name, _data, _len)                                                     \
+	const STRUCT_SECTION_ITERABLE(luaz_bundle, _name##_lua_bundle_entry) = {                  \
+		.data = (_data),                                                                   \
+		.len = (_len),                                                                     \
+	}
+
+#ifdef CONFIG_LUA_BUNDLE
+/**
+ * @brief Load a bundled module and push it as a function.
+ *
+ * @param L     Lua state.
+ * @param name  Module name, as given to require().
+ * @return LUA_OK with the chunk on the stack, -ENOENT if no bundle holds
+ *         @p name (nothing pushed), or a lua_load() error code with the
+ *         error message on the stack.
+ */
+int luaz_bundle_load(lua_State *L, const char *name);
+#else
+static inline int luaz_bundle_load(lua_State *L, const char *name)
+{
+	ARG_UNUSED(L);
+	ARG_UNUSED(name);
+
+	return -ENOENT;
+}
+#endif
+
+#endif /* _LUAZ_BUNDLE_H */
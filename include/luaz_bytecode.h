@@ -0,0 +1,44 @@
+/**
+ * @file luaz_bytecode.h
+ * @brief Loading of pre-compiled bytecode embedded in flash.
+ */
+
+#ifndef _LUAZ_BYTECODE_H
+#define _LUAZ_BYTECODE_H
+
+#include <stddef.h>
+#include <lua.h>
+
+/**
+ * @brief Alignment of embedded bytecode arrays, in bytes.
+ *
+ * Lua aligns the instruction and line arrays of a dump relative to its
+ * start; the blob itself must be aligned for them to be used in place.
+ */
+#define LUAZ_BYTECODE_ALIGN 8
+
+/**
+ * @brief Load a pre-compiled chunk and push it as a function.
+ *
+ * With CONFIG_LUA_BYTECODE_IN_PLACE the chunk is loaded as a fixed buffer
+ * (lua_load() mode "B"): instruction arrays, line information and long
+ * string constants of every function point into @p buf instead of being
+ * copied into the Lua heap.  @p buf must then stay valid and unchanged for
+ * the lifetime of the state, as a static const array in flash does.  An
+ * unaligned @p buf is loaded by copy.  Only binary chunks are accepted.
+ *
+ * With CONFIG_LUA_BYTECODE_COMPRESS, @p buf may also be a chunk compressed
+ * by `luaz_gen.py --compress`.  It is decompressed while it is loaded, in
+ * 1 KB steps through a buffer taken from the state's allocator, and is
+ * always loaded by copy.
+ *
+ * @param L     Lua state.
+ * @param buf   Bytecode, aligned to LUAZ_BYTECODE_ALIGN.
+ * @param len   Size of @p buf in bytes.
+ * @param name  Chunk name used in error messages.
+ * @return LUA_OK with the function on the stack, or an error code with
+ *         the error message on the stack.
+ */
+int luaz_load_bytecode(lua_State *L, const void *buf, size_t len, const char *name);
+
+#endif /* _LUAZ_BYTECODE_H */
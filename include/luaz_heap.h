@@ -0,0 +1,214 @@
+/**
+ * @file luaz_heap.h
+ * @brief Per-state Lua heap: sys_heap region with an optional slab front-end.
+ *
+ * Every Lua state owns a struct luaz_heap carved out of a static buffer.
+ * With CONFIG_LUA_ALLOC_SLAB, small blocks are served from per-size-class
+ * free lists instead of sys_heap.  With CONFIG_LUA_ALLOC_STATS, every heap
+ * keeps allocation statistics, readable live from the `lua_mem` shell
+ * command and from Lua (zephyr.mem_stats()).  With CONFIG_LUA_MEM_LIMIT,
+ * a per-state limit caps the bytes Lua may hold and drives the GC harder
+ * as usage approaches it.
+ */
+
+#ifndef _LUAZ_HEAP_H
+#define _LUAZ_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <zephyr/sys/slist.h>
+#include <zephyr/sys/sys_heap.h>
+
+#ifdef CONFIG_LUA_ALLOC_SLAB
+/** @brief Slab size-class granularity (and block alignment) in bytes. */
+#define LUAZ_SLAB_ALIGN 8
+/** @brief Number of slab size classes (8, 16, ... CONFIG_LUA_ALLOC_SLAB_MAX_SIZE bytes). */
+#define LUAZ_SLAB_CLASSES (CONFIG_LUA_ALLOC_SLAB_MAX_SIZE / LUAZ_SLAB_ALIGN)
+#endif
+
+#if defined(CONFIG_LUA_ALLOC_STATS) || defined(CONFIG_LUA_MEM_LIMIT)
+/** @brief Defined when heaps track the bytes Lua holds (struct luaz_heap::in_use). */
+#define LUAZ_HEAP_TRACK_USE 1
+#endif
+
+#ifdef CONFIG_LUA_ALLOC_STATS
+/** @brief Number of power-of-two request size buckets; the last one is open-ended. */
+#define LUAZ_HEAP_HIST_BUCKETS 16
+/** @brief Object kinds tracked per type: the Lua type tags < LUA_NUMTYPES. */
+#define LUAZ_HEAP_TYPES LUA_NUMTYPES
+
+/**
+ * @brief Allocation statistics of one Lua heap.
+ *
+ * Byte counts are the sizes Lua requested (what collectgarbage("count")
+ * reports), without slab rounding or sys_heap chunk overhead.
+ */
+struct luaz_heap_stats {
+	/** New blocks (ptr == NULL). */
+	uint32_t allocs;
+	/** Freed blocks. */
+	uint32_t frees;
+	/** Resized blocks. */
+	uint32_t reallocs;
+	/** Allocations and reallocations that returned NULL. */
+	uint32_t failures;
+	/** High-water mark of struct luaz_heap::in_use. */
+	size_t peak;
+	/** Requests of 2^i to 2^(i+1) - 1 bytes (allocs and reallocs). */
+	uint32_t size_hist[LUAZ_HEAP_HIST_BUCKETS];
+	/**
+	 * Bytes allocated for new objects of each Lua type (LUA_TSTRING,
+	 * LUA_TTABLE, ...), from the type tag Lua passes as osize.  Index
+	 * LUA_TNIL counts every other allocation (arrays, stacks, buffers).
+	 * Cumulative: frees carry no type.
+	 */
+	size_t type_bytes[LUAZ_HEAP_TYPES];
+};
+#endif
+
+/**
+ * @brief Heap of one Lua state, passed as the allocator user data.
+ */
+struct luaz_heap {
+	/** Backing heap; also serves blocks too large for the slab. */
+	struct sys_heap heap;
+#ifdef CONFIG_LUA_ALLOC_SLAB
+	/** Singly linked free blocks of each size class. */
+	void *free_list[LUAZ_SLAB_CLASSES];
+	/** Unused part of the page blocks are currently carved from. */
+	uint8_t *page_pos;
+	/** Bytes left at @ref page_pos. */
+	size_t page_left;
+#endif
+#ifdef LUAZ_HEAP_TRACK_USE
+	/** Size of the backing region in bytes. */
+	size_t size;
+	/** Bytes Lua currently holds (requested sizes, as collectgarbage("count")). */
+	size_t in_use;
+#endif
+#ifdef CONFIG_LUA_MEM_LIMIT
+	/** Requests growing @ref in_use beyond this many bytes fail. */
+	size_t limit;
+	/** Usage above which the GC is driven harder (set from @ref limit). */
+	size_t pressure_mark;
+	/** The GC runs with the pressure pause; @ref saved_pause holds the normal one. */
+	bool gc_pressure;
+	/** Pause parameter to restore once pressure is relieved. */
+	int saved_pause;
+#endif
+#ifdef CONFIG_LUA_IDLE_GC
+	/** GC steps run in idle time by blocking bindings (luaz_idle_gc()). */
+	uint32_t idle_gc_steps;
+	/** GC cycles completed in idle time. */
+	uint32_t idle_gc_cycles;
+	/** Time spent on idle GC, in microseconds. */
+	uint32_t idle_gc_us;
+	/** Lua memory use when the last idle GC cycle completed. */
+	size_t idle_gc_base;
+#endif
+#ifdef CONFIG_LUA_ALLOC_STATS
+	/** Name shown by the `lua_mem` shell command. */
+	const char *name;
+	/** Allocation statistics since the last luaz_heap_init(). */
+	struct luaz_heap_stats stats;
+	/** Node in the global list of heaps. */
+	sys_snode_t node;
+#endif
+};
+
+/**
+ * @brief Initialize a Lua heap over a memory region.
+ *
+ * Must be called before lua_newstate() and again before reusing the region
+ * for a new state; blocks and statistics of the previous state are dropped.
+ * With CONFIG_LUA_ALLOC_STATS the heap is registered (once) in the list
+ * shown by the `lua_mem` shell command.
+ *
+ * @param h     Heap to initialize.
+ * @param name  Heap name for reports (static string).
+ * @param mem   Backing memory region.
+ * @param size  Size of @p mem in bytes.
+ */
+void luaz_heap_init(struct luaz_heap *h, const char *name, void *mem, size_t size);
+
+/**
+ * @brief Custom Lua allocator backed by a struct luaz_heap.
+ *
+ * Conforms to the lua_Alloc signature.  Passed as the allocator function
+ * to lua_newstate, with the struct luaz_heap pointer as @p ud.
+ *
+ * @param ud     Pointer to the struct luaz_heap used for allocation.
+ * @param ptr    Pointer to the existing block (NULL for new allocations).
+ * @param osize  Original block size (object type tag when @p ptr is NULL).
+ * @param nsize  Requested new size (0 to free).
+ * @return Pointer to the (re)allocated block, or NULL on free / failure.
+ */
+void *lua_zephyr_allocator(void *ud, void *ptr, size_t osize, size_t nsize);
+
+/**
+ * @brief Print thread memory usage report (heap and stack) as a table.
+ *
+ * Conditionally prints heap stats (CONFIG_SYS_HEAP_RUNTIME_STATS)
+ * and stack stats (CONFIG_INIT_STACKS + CONFIG_THREAD_STACK_INFO).
+ * Slab pages count as allocated heap.
+ *
+ * @param h          Heap to query.
+ * @param heap_size  Total heap size in bytes.
+ */
+void luaz_print_mem_usage(struct luaz_heap *h, size_t heap_size);
+
+#ifdef CONFIG_LUA_MEM_LIMIT
+/**
+ * @brief Set the memory limit of a Lua heap.
+ *
+ * Requests that would grow the bytes Lua holds beyond @p limit fail; Lua
+ * then runs an emergency full collection and retries once before raising
+ * a memory error.  Above CONFIG_LUA_MEM_PRESSURE_PERCENT of the limit,
+ * luaz_heap_gc_check() makes the collector more aggressive.
+ *
+ * @param h      Heap to limit.
+ * @param limit  Limit in bytes; 0 resets it to the heap size.
+ */
+void luaz_heap_set_limit(struct luaz_heap *h, size_t limit);
+
+/**
+ * @brief Drive the GC of a state according to its memory pressure.
+ *
+ * The allocator cannot call into the collector, so blocking bindings
+ * (msleep, zbus waits, zephyr.run) call this at their safe points.  Under
+ * pressure the GC pause is lowered to CONFIG_LUA_MEM_PRESSURE_GC_PAUSE and
+ * a GC step is run; the original pause is restored once usage drops back.
+ *
+ * @param L  Lua state whose allocator user data is a struct luaz_heap.
+ */
+void luaz_heap_gc_check(lua_State *L);
+
+/**
+ * @brief Lua function: zephyr.mem_limit([bytes]) -> limit, in_use, pressure.
+ *
+ * Sets the limit of the calling state's heap when @p bytes is given (0
+ * resets it to the heap size) and reports the limit, the bytes in use and
+ * whether usage is above the pressure mark.
+ */
+int luaz_heap_mem_limit(lua_State *L);
+#else
+static inline void luaz_heap_gc_check(lua_State *L)
+{
+	(void)L;
+}
+#endif
+
+#ifdef CONFIG_LUA_ALLOC_STATS
+/**
+ * @brief Lua function: zephyr.mem_stats() -> table.
+ *
+ * Statistics of the calling state's heap: allocs, frees, reallocs,
+ * failures, in_use, peak and size, plus `hist` (hist[i] counts requests
+ * of 2^(i-1) to 2^i - 1 bytes) and `types` (bytes allocated per Lua type
+ * name; `other` for non-object allocations).
+ */
+int luaz_heap_mem_stats(lua_State *L);
+#endif
+
+#endif /* _LUAZ_HEAP_H */
@@ -24,20 +24,32 @@ enum lua_msg_field_type {
 	LUA_MSG_TYPE_STRING_BUF, /* inline char[] -> lua_pushstring */
 	LUA_MSG_TYPE_BOOL,       /* bool -> lua_pushboolean */
 	LUA_MSG_TYPE_OBJECT,     /* nested struct -> nested Lua table */
+	LUA_MSG_TYPE_ARRAY,      /* fixed/counted array of INT/UINT/NUMBER/BOOL -> sequence */
 };
 
+/** @brief count_offset value of an array field without a count (fixed length). */
+#define LUA_MSG_ARRAY_FIXED UINT16_MAX
+
 /**
  * @brief Descriptor for a single field in a message struct.
  *
  * Each descriptor maps a C struct field to a named Lua table entry.
  * For nested structs (LUA_MSG_TYPE_OBJECT), sub_fields and sub_field_count
- * point to the nested field descriptor array.
+ * point to the nested field descriptor array.  For arrays
+ * (LUA_MSG_TYPE_ARRAY), size is the element size, elem_type the element
+ * type, max_count the capacity and count_offset/count_size locate the
+ * element count in the struct (LUA_MSG_ARRAY_FIXED when the whole array is
+ * always used).
  */
 struct lua_msg_field_descr {
 	const char *field_name;
 	enum lua_msg_field_type type;
 	uint16_t offset;
 	uint8_t size;
+	uint8_t elem_type;
+	uint16_t max_count;
+	uint16_t count_offset;
+	uint8_t count_size;
 	const struct lua_msg_field_descr *sub_fields;
 	size_t sub_field_count;
 };
@@ -89,6 +101,55 @@ struct lua_msg_descr {
 		.sub_field_count = ARRAY_SIZE(_sub_fields),           \
 	}
 
+/**
+ * @brief Define a fixed-length array field descriptor.
+ *
+ * Every element of the C array is converted; the Lua side sees a sequence
+ * of ARRAY_SIZE(_field) values.
+ *
+ * @param _struct     The C struct type.
+ * @param _field      The array field name.
+ * @param _elem_type  Element lua_msg_field_type (INT, UINT, NUMBER or BOOL).
+ */
+#define LUA_MSG_FIELD_ARRAY(_struct, _field, _elem_type)              \
+	{                                                             \
+		.field_name = #_field,                                \
+		.type = LUA_MSG_TYPE_ARRAY,                           \
+		.offset = offsetof(_struct, _field),                  \
+		.size = sizeof(((_struct *)0)->_field[0]),             \
+		.elem_type = (_elem_type),                            \
+		.max_count = ARRAY_SIZE(((_struct *)0)->_field),       \
+		.count_offset = LUA_MSG_ARRAY_FIXED,                  \
+		.sub_fields = NULL,                                   \
+		.sub_field_count = 0,                                 \
+	}
+
+/**
+ * @brief Define a counted array field descriptor.
+ *
+ * Only the first _count_field elements are converted to Lua; decoding a
+ * Lua sequence stores its length (clamped to the capacity) in
+ * _count_field.  This matches nanopb's static repeated fields.
+ *
+ * @param _struct       The C struct type.
+ * @param _field        The array field name.
+ * @param _elem_type    Element lua_msg_field_type (INT, UINT, NUMBER or BOOL).
+ * @param _count_field  Integer field holding the number of used elements.
+ */
+#define LUA_MSG_FIELD_ARRAY_COUNT(_struct, _field, _elem_type, _count_field) \
+	{                                                             \
+		.field_name = #_field,                                \
+		.type = LUA_MSG_TYPE_ARRAY,                           \
+		.offset = offsetof(_struct, _field),                  \
+		.size = sizeof(((_struct *)0)->_field[0]),             \
+		.elem_type = (_elem_type),                            \
+		.max_count = ARRAY_SIZE(((_struct *)0)->_field),       \
+		.count_offset = offsetof(_struct, _count_field),      \
+		.count_size = sizeof(((_struct *)0)->_count_field),    \
+		.sub_fields = NULL,                                   \
+		.sub_field_count = 0,                                 \
+	}
+
 /**
  * @brief Define a standalone message descriptor.
  *
@@ -130,6 +191,22 @@ struct lua_msg_descr {
 
 /* clang-format on */
 
+/**
+ * @brief Bind a descriptor to a Lua state.
+ *
+ * Compiles @p fields and every nested object into a flat op program,
+ * interns the field names and caches both in the registry.  Conversions
+ * bind lazily on first use, so calling this is optional; it moves the
+ * one-time cost out of the first message.  Raises a Lua error if the tree
+ * nests deeper than CONFIG_LUA_MSG_DESCR_MAX_DEPTH.
+ *
+ * @param L            Lua state.
+ * @param fields       Array of field descriptors.
+ * @param field_count  Number of fields.
+ */
+void lua_msg_descr_bind(lua_State *L, const struct lua_msg_field_descr *fields,
+			size_t field_count);
+
 /**
  * @brief Encode C struct fields into a Lua table (push to stack).
  *
@@ -141,6 +218,21 @@ struct lua_msg_descr {
 void lua_msg_descr_to_table(lua_State *L, const struct lua_msg_field_descr *fields,
 			    size_t field_count, const void *base);
 
+/**
+ * @brief Encode C struct fields into an existing Lua table.
+ *
+ * Overwrites the described fields of the table in place and reuses nested
+ * subtables, so a caller-owned table can be refilled without allocating.
+ *
+ * @param L            Lua state.
+ * @param fields       Array of field descriptors.
+ * @param field_count  Number of fields.
+ * @param base         Base pointer to the C struct data.
+ * @param table_idx    Absolute Lua stack index of the destination table.
+ */
+void lua_msg_descr_fill_table(lua_State *L, const struct lua_msg_field_descr *fields,
+			      size_t field_count, const void *base, int table_idx);
+
 /**
  * @brief Decode a Lua table into C struct fields.
  *
@@ -153,4 +245,39 @@ void lua_msg_descr_to_table(lua_State *L, const struct lua_msg_field_descr *fiel
 void lua_msg_descr_from_table(lua_State *L, const struct lua_msg_field_descr *fields,
 			      size_t field_count, void *base, int table_idx);
 
+/**
+ * @brief Push the field-name index of a descriptor.
+ *
+ * Pushes a table mapping each top-level field name of @p fields to its
+ * 1-based position in the array, binding the descriptor if needed.  Used
+ * to resolve single fields by name without scanning the descriptor.
+ *
+ * @param L            Lua state.
+ * @param fields       Array of field descriptors.
+ * @param field_count  Number of fields.
+ */
+void lua_msg_descr_push_field_index(lua_State *L, const struct lua_msg_field_descr *fields,
+				    size_t field_count);
+
+/**
+ * @brief Decode a single field of a C struct and push its Lua value.
+ *
+ * @param L     Lua state.
+ * @param f     Field descriptor.
+ * @param base  Base pointer to the C struct holding @p f.
+ */
+void lua_msg_descr_push_field(lua_State *L, const struct lua_msg_field_descr *f,
+			      const void *base);
+
+/**
+ * @brief Convert a Lua value and store it into a single field of a C struct.
+ *
+ * @param L     Lua state.
+ * @param f     Field descriptor.
+ * @param base  Base pointer to the C struct holding @p f.
+ * @param idx   Stack index of the value.
+ */
+void lua_msg_descr_store_field(lua_State *L, const struct lua_msg_field_descr *f, void *base,
+			       int idx);
+
 #endif /* LUAZ_MSG_DESCR_H */
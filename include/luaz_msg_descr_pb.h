@@ -22,9 +22,15 @@
  *   LUA_PB_DESCR_DEFINE(msg_sensor_config);
  *   ZBUS_CHAN_DEFINE(chan_sensor_config, ...);
  *
+ * REPEATED fields (with max_count) map to LUA_MSG_FIELD_ARRAY_COUNT using
+ * nanopb's <field>_count member, FIXARRAY fields (fixed_count) map to
+ * LUA_MSG_FIELD_ARRAY:
+ *
+ *   message MsgAccBurst { repeated int32 x = 1 [(nanopb).max_count = 32]; }
+ *
  * Limitations:
  *   - ONEOF fields not supported (fieldname is a tuple)
- *   - REPEATED/FIXARRAY fields not supported
+ *   - REPEATED/FIXARRAY only for numeric, bool and enum element types
  *   - Only STATIC allocation type supported
  */
 
@@ -59,6 +65,28 @@
 #define LUA_PB_GEN_ENUM(_name, f)            LUA_MSG_FIELD(struct _name, f, LUA_MSG_TYPE_INT)
 #define LUA_PB_GEN_UENUM(_name, f)           LUA_MSG_FIELD(struct _name, f, LUA_MSG_TYPE_UINT)
 
+/**
+ * @brief Element-type mapping for REPEATED/FIXARRAY fields: ltype -> lua_msg_field_type.
+ *
+ * Only numeric, bool and enum element types have a mapping; a repeated
+ * field of any other type fails to compile.
+ */
+#define LUA_PB_ELEM_BOOL                     LUA_MSG_TYPE_BOOL
+#define LUA_PB_ELEM_INT32                    LUA_MSG_TYPE_INT
+#define LUA_PB_ELEM_SINT32                   LUA_MSG_TYPE_INT
+#define LUA_PB_ELEM_SFIXED32                 LUA_MSG_TYPE_INT
+#define LUA_PB_ELEM_INT64                    LUA_MSG_TYPE_INT
+#define LUA_PB_ELEM_SINT64                   LUA_MSG_TYPE_INT
+#define LUA_PB_ELEM_SFIXED64                 LUA_MSG_TYPE_INT
+#define LUA_PB_ELEM_UINT32                   LUA_MSG_TYPE_UINT
+#define LUA_PB_ELEM_FIXED32                  LUA_MSG_TYPE_UINT
+#define LUA_PB_ELEM_UINT64                   LUA_MSG_TYPE_UINT
+#define LUA_PB_ELEM_FIXED64                  LUA_MSG_TYPE_UINT
+#define LUA_PB_ELEM_FLOAT                    LUA_MSG_TYPE_NUMBER
+#define LUA_PB_ELEM_DOUBLE                   LUA_MSG_TYPE_NUMBER
+#define LUA_PB_ELEM_ENUM                     LUA_MSG_TYPE_INT
+#define LUA_PB_ELEM_UENUM                    LUA_MSG_TYPE_UINT
+
 /**
  * @brief Auto-resolve nested MESSAGE fields via nanopb MSGTYPE macros.
  *
@@ -80,20 +108,35 @@
 	}
 
 /**
- * @brief X-macro callback: dispatches on nanopb ltype via token pasting.
+ * @brief Handling-type mapping macros: nanopb htype -> field descriptor.
+ *
+ * Scalar handling types dispatch on ltype through LUA_PB_GEN_<ltype>;
+ * REPEATED and FIXARRAY produce array descriptors whose element type is
+ * resolved through LUA_PB_ELEM_<ltype>.
+ */
+#define LUA_PB_GEN_H_REQUIRED(_name, ltype, f) LUA_PB_GEN_##ltype(_name, f)
+#define LUA_PB_GEN_H_OPTIONAL(_name, ltype, f) LUA_PB_GEN_##ltype(_name, f)
+#define LUA_PB_GEN_H_SINGULAR(_name, ltype, f) LUA_PB_GEN_##ltype(_name, f)
+#define LUA_PB_GEN_H_REPEATED(_name, ltype, f)                                 \
+	LUA_MSG_FIELD_ARRAY_COUNT(struct _name, f, LUA_PB_ELEM_##ltype, f##_count)
+#define LUA_PB_GEN_H_FIXARRAY(_name, ltype, f)                                 \
+	LUA_MSG_FIELD_ARRAY(struct _name, f, LUA_PB_ELEM_##ltype)
+
+/**
+ * @brief X-macro callback: dispatches on nanopb htype and ltype via token pasting.
  *
  * Called by the nanopb-generated FIELDLIST macro for each field.
- * Ignores atype, htype, and tag; dispatches solely on ltype.
+ * Ignores atype and tag.
  *
  * @param _name       The struct tag name (passed as the accumulator 'a').
  * @param atype       Allocation type (STATIC, POINTER, CALLBACK) - ignored.
- * @param htype       Handling type (REQUIRED, OPTIONAL, etc.) - ignored.
+ * @param htype       Handling type (REQUIRED, REPEATED, etc.) - selects scalar vs array.
  * @param ltype       Logical type (INT32, UINT32, STRING, etc.) - used for dispatch.
  * @param fieldname   The C struct field name.
  * @param tag         Proto field tag number - ignored.
  */
 #define LUA_PB_GEN_FIELD(_name, atype, htype, ltype, fieldname, tag) \
-	LUA_PB_GEN_##ltype(_name, fieldname),
+	LUA_PB_GEN_H_##htype(_name, ltype, fieldname),
 
 /**
  * @brief Define a named descriptor and fields array from a nanopb FIELDLIST.
@@ -0,0 +1,43 @@
+/**
+ * @file luaz_rom.h
+ * @brief Library tables served from flash (CONFIG_LUA_ROM_LIBS).
+ *
+ * Without CONFIG_LUA_ROM_LIBS these helpers build ordinary tables, like
+ * luaL_newlib()/luaL_setfuncs().  With it, library functions stay in their
+ * const luaL_Reg arrays and are looked up there by an __index closure, so a
+ * Lua state holds one small proxy table per library instead of a hash
+ * entry (and an interned name) per function.  Method tables are always
+ * ordinary tables.
+ */
+
+#ifndef _LUAZ_ROM_H
+#define _LUAZ_ROM_H
+
+#include <lua.h>
+#include <lauxlib.h>
+
+/**
+ * @brief Push a library table for @p funcs.
+ *
+ * Fields set later on the table (e.g. nested libraries) take precedence
+ * over @p funcs.  With CONFIG_LUA_ROM_LIBS, pairs() lists @p funcs first,
+ * then those fields.
+ *
+ * @param L      Lua state.
+ * @param funcs  NULL-terminated function list; must outlive the state.
+ */
+void luaz_rom_newlib(lua_State *L, const luaL_Reg *funcs);
+
+/**
+ * @brief Install @p funcs as the methods of the metatable on top of the stack.
+ *
+ * Sets the metatable's __index to itself and copies @p funcs into it, as
+ * with or without CONFIG_LUA_ROM_LIBS: method lookups stay plain table
+ * lookups.
+ *
+ * @param L      Lua state, metatable on top of the stack.
+ * @param funcs  NULL-terminated method list; must outlive the state.
+ */
+void luaz_rom_setmethods(lua_State *L, const luaL_Reg *funcs);
+
+#endif /* _LUAZ_ROM_H */
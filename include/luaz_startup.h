@@ -0,0 +1,120 @@
+/**
+ * @file luaz_startup.h
+ * @brief Startup phase traces of generated Lua threads (CONFIG_LUA_STARTUP_TRACE).
+ *
+ * Every source, bytecode and FS thread defines one trace and stamps it with
+ * k_cycle_get_32() as it goes from thread entry to the first instruction of
+ * its script.  Traces live in an iterable section, so an application or
+ * benchmark can walk them once the threads have started:
+ *
+ *   STRUCT_SECTION_FOREACH(luaz_startup_trace, t) {
+ *           if (t->done) {
+ *                   luaz_startup_print(t);
+ *           }
+ *   }
+ */
+
+#ifndef _LUAZ_STARTUP_H
+#define _LUAZ_STARTUP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <lua.h>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/iterable_sections.h>
+
+/** @brief Points at which a thread's startup is stamped, in order. */
+enum luaz_startup_mark {
+	/** Thread entry. */
+	LUAZ_STARTUP_ENTRY,
+	/** After luaz_heap_init(). */
+	LUAZ_STARTUP_HEAP,
+	/** After lua_newstate(). */
+	LUAZ_STARTUP_NEWSTATE,
+	/** After luaz_openlibs() and luaz_gc_configure(). */
+	LUAZ_STARTUP_OPENLIBS,
+	/** After the <name>_lua_setup() hook. */
+	LUAZ_STARTUP_SETUP,
+	/** After the script is loaded as a function. */
+	LUAZ_STARTUP_LOAD,
+	/** At the first instruction run by lua_pcall(). */
+	LUAZ_STARTUP_FIRST_INSN,
+	LUAZ_STARTUP_MARKS,
+};
+
+/** @brief Startup trace of one Lua thread. */
+struct luaz_startup_trace {
+	/** Thread (script) name. */
+	const char *name;
+	/** "source", "bytecode" or "fs". */
+	const char *flavour;
+	/** k_cycle_get_32() at each enum luaz_startup_mark. */
+	uint32_t mark[LUAZ_STARTUP_MARKS];
+	/** Set once the first instruction has been stamped. */
+	volatile bool done;
+};
+
+#ifdef CONFIG_LUA_STARTUP_TRACE
+
+/**
+ * @brief Define the startup trace of a generated thread.
+ *
+ * @param _name     Thread name.
+ * @param _flavour  Thread flavour, as a string.
+ */
+#define LUAZ_STARTUP_TRACE_DEFINE(_name, _flavour)                                                 \
+	STRUCT_SECTION_ITERABLE(luaz_startup_trace, _name##_lua_startup_trace) = {                \
+		.name = #_name,                                                                    \
+		.flavour = (_flavour),                                                             \
+	}
+
+/** @brief Stamp mark @p _mark of the trace defined for @p _name. */
+#define LUAZ_STARTUP_MARK(_name, _mark) (_name##_lua_startup_trace.mark[(_mark)] = k_cycle_get_32())
+
+/**
+ * @brief Stamp LUAZ_STARTUP_FIRST_INSN when @p L runs its next instruction.
+ *
+ * Installs a one-shot count hook; the hook set before, if any, is put back
+ * once it has fired.  Call right before the lua_pcall() of the script.
+ */
+#define LUAZ_STARTUP_ARM(_name, L) luaz_startup_arm((L), &_name##_lua_startup_trace)
+
+/** @brief Implementation of LUAZ_STARTUP_ARM(). */
+void luaz_startup_arm(lua_State *L, struct luaz_startup_trace *trace);
+
+/**
+ * @brief Print a completed trace as one machine-readable line.
+ *
+ * @code
+ * startup: name=<name> flavour=<flavour> entry=<cyc> heap=<cyc> newstate=<cyc>
+ *          openlibs=<cyc> setup=<cyc> load=<cyc> pcall=<cyc> total=<cyc> us=<us>
+ * @endcode
+ *
+ * (on one line).  entry is the cycle counter at thread entry, which counts
+ * from boot on most platforms; the phases are cycles since the previous
+ * mark, and total and us span thread entry to the first instruction.
+ *
+ * @param trace  Trace with @ref luaz_startup_trace.done set.
+ */
+void luaz_startup_print(const struct luaz_startup_trace *trace);
+
+/**
+ * @brief Cycles from thread entry to the script's first instruction.
+ *
+ * @param trace  Trace with @ref luaz_startup_trace.done set.
+ */
+static inline uint32_t luaz_startup_total(const struct luaz_startup_trace *trace)
+{
+	return trace->mark[LUAZ_STARTUP_FIRST_INSN] - trace->mark[LUAZ_STARTUP_ENTRY];
+}
+
+#else
+
+#define LUAZ_STARTUP_TRACE_DEFINE(_name, _flavour)                                                 \
+	extern struct luaz_startup_trace _name##_lua_startup_trace
+#define LUAZ_STARTUP_MARK(_name, _mark) ((void)0)
+#define LUAZ_STARTUP_ARM(_name, L)      ((void)(L))
+
+#endif /* CONFIG_LUA_STARTUP_TRACE */
+
+#endif /* _LUAZ_STARTUP_H */
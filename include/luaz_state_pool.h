@@ -0,0 +1,45 @@
+/**
+ * @file luaz_state_pool.h
+ * @brief Pool of ready-to-run Lua states for short-lived scripts.
+ *
+ * With CONFIG_LUA_STATE_POOL, CONFIG_LUA_STATE_POOL_SIZE states are created
+ * at boot in fixed heap slots, with luaz_openlibs() already run and every
+ * preloaded library (zephyr, string, ...) already required.  A released
+ * state is reset to that baseline instead of being closed, so the next
+ * acquire skips heap setup, state creation and library loading.
+ */
+
+#ifndef _LUAZ_STATE_POOL_H
+#define _LUAZ_STATE_POOL_H
+
+#include <lua.h>
+#include <zephyr/kernel.h>
+
+/**
+ * @brief Take a pooled Lua state.
+ *
+ * The state has the libraries of luaz_openlibs() loaded and opened (so
+ * require() only looks them up in package.loaded) and the default GC
+ * parameters, and its globals are those it had after opening them.
+ *
+ * @param timeout  How long to wait for a free slot.
+ * @return Lua state, or NULL if no slot became free or the state could
+ *         not be created.
+ */
+lua_State *luaz_state_acquire(k_timeout_t timeout);
+
+/**
+ * @brief Reset a pooled Lua state and return it to the pool.
+ *
+ * Clears the stack, then restores the globals, package.loaded and the
+ * registry to their baseline: entries added since are removed and replaced
+ * ones are put back.  A full collection then frees everything the script
+ * left behind and runs its finalizers (which, e.g., unregister zbus
+ * listeners).  Changes made inside library tables and metatables are not
+ * undone.  If the reset fails, the state is closed and created anew.
+ *
+ * @param L  State returned by luaz_state_acquire().
+ */
+void luaz_state_release(lua_State *L);
+
+#endif /* _LUAZ_STATE_POOL_H */
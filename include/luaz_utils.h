@@ -2,8 +2,8 @@
  * @file luaz_utils.h
  * @brief Core Lua-Zephyr utilities: allocator, kernel bindings, and helper macros.
  *
- * Provides the custom sys_heap-backed allocator for Lua states and convenience
- * macros for library loading and table manipulation.
+ * Pulls in the per-state Lua heap and allocator (luaz_heap.h) and provides
+ * convenience macros for library loading and table manipulation.
  */
 
 #ifndef _LUAZ_UTILS_H
@@ -13,6 +13,7 @@
 #include <lauxlib.h>
 #include <lualib.h>
 #include <zephyr/kernel.h>
+#include <luaz_heap.h>
 
 /* clang-format off */
 
@@ -58,32 +59,58 @@
 /* clang-format on */
 
 /**
- * @brief Print thread memory usage report (heap and stack) as a table.
+ * @brief Configure the garbage collector of a Lua state.
  *
- * Conditionally prints heap stats (CONFIG_SYS_HEAP_RUNTIME_STATS)
- * and stack stats (CONFIG_INIT_STACKS + CONFIG_THREAD_STACK_INFO).
+ * Called by generated threads before the setup hook, with their
+ * CONFIG_<NAME>_LUA_GC_* options.  Parameters of 0 keep Lua's default.
  *
- * @param hp         Pointer to the sys_heap to query.
- * @param heap_size  Total heap size in bytes.
+ * @param L             Lua state.
+ * @param generational  Use the generational instead of the incremental mode.
+ * @param pause         GC pause in percent.
+ * @param stepmul       GC step multiplier in percent.
+ * @param stepsize      GC step size in bytes.
  */
-void luaz_print_mem_usage(struct sys_heap *hp, size_t heap_size);
+void luaz_gc_configure(lua_State *L, bool generational, int pause, int stepmul, int stepsize);
 
 /**
- * @brief Custom Lua allocator backed by a Zephyr sys_heap.
+ * @brief Run incremental GC steps for at most @p budget_us microseconds.
  *
- * Conforms to the lua_Alloc signature.  Passed as the allocator function
- * to lua_newstate, with the sys_heap pointer as @p ud.
+ * Stops early when a collection cycle completes.  Meant for idle time,
+ * e.g. between two zbus waits, so collector work does not land in the
+ * middle of message handling.
  *
- * @param ud     Pointer to the struct sys_heap used for allocation.
- * @param ptr    Pointer to the existing block (NULL for new allocations).
- * @param osize  Original block size.
- * @param nsize  Requested new size (0 to free).
- * @return Pointer to the (re)allocated block, or NULL on free / failure.
+ * @param L          Lua state.
+ * @param budget_us  Time budget in microseconds.
+ * @param done       Set to whether a cycle completed (may be NULL).
+ * @return Number of GC steps run.
  */
-void *lua_zephyr_allocator(void *ud, void *ptr, size_t osize, size_t nsize);
+uint32_t luaz_gc_step_budget(lua_State *L, uint32_t budget_us, bool *done);
 
+#ifdef CONFIG_LUA_IDLE_GC
 /**
- * @brief Open the `zephyr` Lua library (msleep, printk, log_*, zbus, fs).
+ * @brief Spend the idle time before a blocking wait on GC steps.
+ *
+ * Called by blocking bindings (msleep, zbus waits, zephyr.run) when they
+ * are about to block until @p end.  Runs GC steps for at most
+ * CONFIG_LUA_IDLE_GC_BUDGET_US, keeping CONFIG_LUA_IDLE_GC_MIN_SLACK_US
+ * of the wait untouched, and only once Lua memory use has grown by
+ * CONFIG_LUA_IDLE_GC_MIN_GROWTH since the last idle cycle completed.  The
+ * work done is counted in the state's struct luaz_heap.
+ *
+ * @param L    Lua state whose allocator user data is a struct luaz_heap.
+ * @param end  When the wait times out.
+ */
+void luaz_idle_gc(lua_State *L, k_timepoint_t end);
+#else
+static inline void luaz_idle_gc(lua_State *L, k_timepoint_t end)
+{
+	ARG_UNUSED(L);
+	ARG_UNUSED(end);
+}
+#endif
+
+/**
+ * @brief Open the `zephyr` Lua library (msleep, uptime_ms, printk, log_*, zbus, fs).
  *
  * @param L  Lua state.
  * @return 1 (the library table is on the stack).
@@ -2,8 +2,9 @@
  * @file luaz_zbus.h
  * @brief Lua bindings for Zephyr zbus channels and observers.
  *
- * Provides the zbus Lua library opener.  Channels and observers are
- * declared from Lua via zbus.channel_declare() / zbus.observer_declare().
+ * Provides the zbus Lua library opener and the zephyr.run() event loop.
+ * Channels and observers are declared from Lua via zbus.channel_declare() /
+ * zbus.observer_declare().
  */
 
 #ifndef _LUAZ_ZBUS_H
@@ -19,4 +20,16 @@
  */
 int luaopen_zbus(lua_State *L);
 
+/**
+ * @brief Lua function zephyr.run([timeout_ms]): zbus.listen() event loop.
+ *
+ * Dispatches the listener callbacks registered by the calling Lua state
+ * until the timeout elapses (forever when omitted).  Registered in the
+ * `zephyr` library when CONFIG_LUA_ZBUS_LISTEN is enabled.
+ *
+ * @param L  Lua state.
+ * @return 1 (number of dispatched callbacks).
+ */
+int luaz_zbus_run(lua_State *L);
+
 #endif /* _LUAZ_ZBUS_H */
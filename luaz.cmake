@@ -45,7 +45,32 @@ config ${_name_upper}_LUA_THREAD_PRIORITY\n\
     int \"${_name} Lua thread priority\"\n\
     default LUA_THREAD_PRIORITY\n\
     help\n\
-      Priority for the ${_name} Lua thread.\n"
+      Priority for the ${_name} Lua thread.\n\
+\n\
+config ${_name_upper}_LUA_GC_GENERATIONAL\n\
+    bool \"${_name} Lua thread uses the generational GC\"\n\
+    default LUA_GC_GENERATIONAL\n\
+    help\n\
+      Run the ${_name} Lua thread's collector in generational mode\n\
+      instead of incremental mode.\n\
+\n\
+config ${_name_upper}_LUA_GC_PAUSE\n\
+    int \"${_name} Lua thread GC pause (percent, 0 = Lua default)\"\n\
+    default LUA_GC_PAUSE\n\
+    help\n\
+      GC pause for the ${_name} Lua thread.\n\
+\n\
+config ${_name_upper}_LUA_GC_STEPMUL\n\
+    int \"${_name} Lua thread GC step multiplier (percent, 0 = Lua default)\"\n\
+    default LUA_GC_STEPMUL\n\
+    help\n\
+      GC step multiplier for the ${_name} Lua thread.\n\
+\n\
+config ${_name_upper}_LUA_GC_STEPSIZE\n\
+    int \"${_name} Lua thread GC step size (bytes, 0 = Lua default)\"\n\
+    default LUA_GC_STEPSIZE\n\
+    help\n\
+      GC step size for the ${_name} Lua thread.\n"
     )
 endmacro()
 
@@ -121,10 +146,73 @@ if(CONFIG_LUA_PRECOMPILE)
     endif()
 endif()
 
+# Build the host heap profiler (when CONFIG_LUA_HEAP_PROFILE is enabled), from
+# the same Lua core sources as luac.  Unlike luac it is a build rule, so it is
+# rebuilt whenever the profiler, its stubs or the Lua core change.  The target
+# luaz_heap_profile_host lets _luaz_add_heap_profile(), which runs in the
+# application directory, order itself after it.
+if(CONFIG_LUA_HEAP_PROFILE)
+    set(LUA_MOD_DIR "${CMAKE_CURRENT_LIST_DIR}")
+    find_program(HOST_CC NAMES cc gcc REQUIRED)
+
+    set(LUAZ_HEAP_PROFILE_HOST "${CMAKE_CURRENT_BINARY_DIR}/host_tools/luaz_heap_profile"
+        CACHE INTERNAL "Path to host-built Lua heap profiler")
+
+    file(MAKE_DIRECTORY "${CMAKE_CURRENT_BINARY_DIR}/host_tools")
+    file(GLOB LUAZ_HEAP_PROFILE_SRCS "${LUA_MOD_DIR}/lua/l*.c")
+    list(REMOVE_ITEM LUAZ_HEAP_PROFILE_SRCS "${LUA_MOD_DIR}/lua/lua.c" "${LUA_MOD_DIR}/lua/ltests.c")
+    list(APPEND LUAZ_HEAP_PROFILE_SRCS "${LUA_MOD_DIR}/host_tools/luaz_heap_profile.c")
+    file(GLOB LUAZ_HEAP_PROFILE_HDRS "${LUA_MOD_DIR}/lua/*.h" "${LUA_MOD_DIR}/include/*.h")
+
+    # luaz_check_stubs.py fails the build when a target binding has no stub
+    # in the profiler, so it also depends on the binding sources.
+    add_custom_command(
+        OUTPUT "${LUAZ_HEAP_PROFILE_HOST}"
+        COMMAND ${PYTHON_EXECUTABLE} "${LUA_MOD_DIR}/scripts/luaz_check_stubs.py" "${LUA_MOD_DIR}"
+        COMMAND ${HOST_CC}
+            ${LUAZ_HEAP_PROFILE_SRCS}
+            -I${LUA_MOD_DIR}/include
+            -I${LUA_MOD_DIR}/lua
+            -O2 -DLUA_USE_POSIX -DLUA_32BITS -lm
+            -o "${LUAZ_HEAP_PROFILE_HOST}"
+        DEPENDS
+            ${LUAZ_HEAP_PROFILE_SRCS}
+            ${LUAZ_HEAP_PROFILE_HDRS}
+            "${LUA_MOD_DIR}/scripts/luaz_check_stubs.py"
+            "${LUA_MOD_DIR}/src/luaz_zbus.c"
+            "${LUA_MOD_DIR}/src/luaz_utils.c"
+        COMMENT "Building host Lua heap profiler"
+    )
+    add_custom_target(luaz_heap_profile_host DEPENDS "${LUAZ_HEAP_PROFILE_HOST}")
+endif()
+
 # Path to the unified Lua generator script used by all luaz_add_* functions.
 set(LUA_GENERATE_SCRIPT "${CMAKE_CURRENT_LIST_DIR}/scripts/luaz_gen.py"
     CACHE INTERNAL "Path to luaz_gen.py")
 
+# _luaz_bytecode_gen_args(OUT_VAR)
+#
+# Extra luaz_gen.py arguments for the bytecode mode: --compress with
+# CONFIG_LUA_BYTECODE_COMPRESS, --optimize with CONFIG_LUA_OPTIMIZE, --lazy
+# with CONFIG_LUA_LAZY_FUNCTIONS, and one --define per NAME=VALUE entry of
+# the LUAZ_LUA_DEFINES list.
+function(_luaz_bytecode_gen_args _out)
+    set(_args "")
+    if(CONFIG_LUA_BYTECODE_COMPRESS)
+        list(APPEND _args --compress)
+    endif()
+    if(CONFIG_LUA_OPTIMIZE)
+        list(APPEND _args --optimize)
+        if(CONFIG_LUA_LAZY_FUNCTIONS)
+            list(APPEND _args --lazy)
+        endif()
+        foreach(_define ${LUAZ_LUA_DEFINES})
+            list(APPEND _args --define "${_define}")
+        endforeach()
+    endif()
+    set(${_out} ${_args} PARENT_SCOPE)
+endfunction()
+
 
 # luaz_add_file(FILE_NAME_PATH)
 #
@@ -216,6 +304,9 @@ endfunction()
 # Runs luaz_gen.py in bytecode mode (which invokes luac -s) to produce
 # <name>_lua_bytecode.h.  The generated header is placed under
 # ${CMAKE_CURRENT_BINARY_DIR}/lua and made available via include_directories.
+# With CONFIG_LUA_BYTECODE_COMPRESS=y the array holds the compressed chunk;
+# load it with luaz_load_bytecode().  With CONFIG_LUA_OPTIMIZE=y the script
+# goes through luaz_opt.py first, with the defines in LUAZ_LUA_DEFINES.
 #
 # The .lua source file is tracked as a dependency for incremental builds.
 #
@@ -237,6 +328,7 @@ function(luaz_add_bytecode_file FILE_NAME_PATH)
     set(LUA_OUTPUT_DIR "${CMAKE_CURRENT_BINARY_DIR}/lua")
     set(LUA_OUTPUT "${LUA_OUTPUT_DIR}/${FILE_NAME}_lua_bytecode.h")
     set(LUA_TEMPLATE "${CMAKE_CURRENT_FUNCTION_LIST_DIR}/templates/lua_bytecode_template.h.in")
+    _luaz_bytecode_gen_args(LUA_BYTECODE_GEN_ARGS)
 
     add_custom_command(
         OUTPUT "${LUA_OUTPUT}"
@@ -246,6 +338,7 @@ function(luaz_add_bytecode_file FILE_NAME_PATH)
             --output "${LUA_OUTPUT}"
             --name "${FILE_NAME}"
             --luac "${LUAC_HOST}"
+            ${LUA_BYTECODE_GEN_ARGS}
             "${LUA_FILE}"
         DEPENDS "${LUA_FILE}" "${LUA_TEMPLATE}"
         COMMENT "Generating ${FILE_NAME}_lua_bytecode.h from ${FILE_NAME}.lua"
@@ -266,7 +359,11 @@ endfunction()
 # <name>_lua_bytecode_thread.c containing:
 #   - A dedicated sys_heap and stack
 #   - A weak _lua_setup hook for pre-script initialization
-#   - A K_THREAD_DEFINE that loads and runs the bytecode via luaL_loadbuffer
+#   - A K_THREAD_DEFINE that loads and runs the bytecode via luaz_load_bytecode
+#
+# With CONFIG_LUA_BYTECODE_COMPRESS=y the bytecode is compressed at build
+# time and decompressed while it is loaded.  With CONFIG_LUA_OPTIMIZE=y the
+# script goes through luaz_opt.py first, with the defines in LUAZ_LUA_DEFINES.
 #
 # The generated .c file is automatically added to the `app` target.
 # The .lua source file is tracked as a dependency for incremental builds.
@@ -289,6 +386,7 @@ function(luaz_add_bytecode_thread FILE_NAME_PATH)
     set(LUA_OUTPUT_DIR "${CMAKE_CURRENT_BINARY_DIR}/lua")
     set(LUA_OUTPUT "${LUA_OUTPUT_DIR}/${FILE_NAME}_lua_bytecode_thread.c")
     set(LUA_TEMPLATE "${CMAKE_CURRENT_FUNCTION_LIST_DIR}/templates/lua_bytecode_thread.c.in")
+    _luaz_bytecode_gen_args(LUA_BYTECODE_GEN_ARGS)
 
     add_custom_command(
         OUTPUT "${LUA_OUTPUT}"
@@ -298,6 +396,7 @@ function(luaz_add_bytecode_thread FILE_NAME_PATH)
             --output "${LUA_OUTPUT}"
             --name "${FILE_NAME}"
             --luac "${LUAC_HOST}"
+            ${LUA_BYTECODE_GEN_ARGS}
             "${LUA_FILE}"
         DEPENDS "${LUA_FILE}" "${LUA_TEMPLATE}"
         COMMENT "Generating ${FILE_NAME}_lua_bytecode_thread.c from ${FILE_NAME}.lua"
@@ -309,6 +408,65 @@ function(luaz_add_bytecode_thread FILE_NAME_PATH)
 endfunction()
 
 
+# luaz_add_bundle(BUNDLE_NAME FILE_NAME_PATH...)
+#
+# Pack pre-compiled Lua modules into one archive that require() searches.
+#
+# Runs luaz_gen.py in bundle mode (which invokes luac -s on every file) to
+# produce <bundle>_lua_bundle.c: one flash array with a sorted name index,
+# registered with LUAZ_BUNDLE_DEFINE.  Each module is named after its file
+# without the last extension, so src/lib/sensor.util.lua is required as
+# "sensor.util".  Modules with identical bytecode are stored once.  The
+# compression and optimizer options apply to every module.
+#
+# The generated .c file is automatically added to the `app` target.
+# The .lua source files are tracked as dependencies for incremental builds.
+#
+# Requires CONFIG_LUA_BUNDLE=y.
+#
+# Arguments:
+#   BUNDLE_NAME    - C identifier for the archive.
+#   FILE_NAME_PATH - Paths to the .lua files (relative to project source dir).
+function(luaz_add_bundle BUNDLE_NAME)
+    if(NOT CONFIG_LUA_BUNDLE)
+        message(FATAL_ERROR
+            "luaz_add_bundle(${BUNDLE_NAME}) requires CONFIG_LUA_BUNDLE=y. "
+            "Enable it in your prj.conf to bundle Lua modules.")
+    endif()
+
+    set(LUA_FILES "")
+    foreach(_path ${ARGN})
+        list(APPEND LUA_FILES "${CMAKE_CURRENT_SOURCE_DIR}/${_path}")
+    endforeach()
+    if(LUA_FILES STREQUAL "")
+        message(FATAL_ERROR "luaz_add_bundle(${BUNDLE_NAME}) needs at least one .lua file")
+    endif()
+
+    list(LENGTH LUA_FILES LUA_FILE_COUNT)
+
+    set(LUA_OUTPUT_DIR "${CMAKE_CURRENT_BINARY_DIR}/lua")
+    set(LUA_OUTPUT "${LUA_OUTPUT_DIR}/${BUNDLE_NAME}_lua_bundle.c")
+    set(LUA_TEMPLATE "${CMAKE_CURRENT_FUNCTION_LIST_DIR}/templates/lua_bundle.c.in")
+    _luaz_bytecode_gen_args(LUA_BYTECODE_GEN_ARGS)
+
+    add_custom_command(
+        OUTPUT "${LUA_OUTPUT}"
+        COMMAND ${PYTHON_EXECUTABLE} "${LUA_GENERATE_SCRIPT}"
+            --mode bundle
+            --template "${LUA_TEMPLATE}"
+            --output "${LUA_OUTPUT}"
+            --name "${BUNDLE_NAME}"
+            --luac "${LUAC_HOST}"
+            ${LUA_BYTECODE_GEN_ARGS}
+            ${LUA_FILES}
+        DEPENDS ${LUA_FILES} "${LUA_TEMPLATE}"
+        COMMENT "Generating ${BUNDLE_NAME}_lua_bundle.c from ${LUA_FILE_COUNT} Lua modules"
+    )
+
+    target_sources(app PRIVATE "${LUA_OUTPUT}")
+endfunction()
+
+
 # luaz_add_fs_thread(SCRIPT_FS_PATH)
 #
 # Generate a Lua thread that loads its script from the filesystem at runtime.
@@ -371,4 +529,102 @@ function(luaz_generate_threads)
     foreach(_path ${LUAZ_FS_THREADS})
         luaz_add_fs_thread("${_path}")
     endforeach()
+    if(CONFIG_LUA_HEAP_PROFILE)
+        _luaz_add_heap_profile()
+    endif()
+endfunction()
+
+
+# _luaz_add_heap_profile()
+#
+# Profile the heap use of the source and bytecode threads on the host.
+#
+# Runs luaz_heap_profile over every script in LUAZ_SOURCE_THREADS and
+# LUAZ_BYTECODE_THREADS, with the libraries, GC parameters and loading mode
+# the thread uses on the target, and writes the suggested heap sizes to
+# ${CMAKE_BINARY_DIR}/luaz_heap_profile.conf.  With CONFIG_LUA_OPTIMIZE, the
+# bytecode threads are profiled from the luaz_opt output (luaz_gen.py optimize
+# mode) under ${CMAKE_BINARY_DIR}/lua_profile, with the functions split out by
+# CONFIG_LUA_LAZY_FUNCTIONS next to it.  FS threads are skipped: their scripts
+# only exist on the target filesystem.
+function(_luaz_add_heap_profile)
+    set(_libs "")
+    foreach(_lib BASE STRING TABLE MATH COROUTINE UTF8 DEBUG)
+        if(CONFIG_LUA_LIB_${_lib})
+            string(TOLOWER "${_lib}" _lib)
+            list(APPEND _libs "${_lib}")
+        endif()
+    endforeach()
+    list(JOIN _libs "," _libs)
+    if(_libs STREQUAL "")
+        set(_libs none)
+    endif()
+
+    set(_args "")
+    set(_deps "${LUAZ_HEAP_PROFILE_HOST}")
+    set(_opt_dir "${CMAKE_BINARY_DIR}/lua_profile")
+    _luaz_bytecode_gen_args(_gen_args)
+    list(REMOVE_ITEM _gen_args --compress)
+    foreach(_kind SOURCE BYTECODE)
+        foreach(_path ${LUAZ_${_kind}_THREADS})
+            cmake_path(GET _path FILENAME _name)
+            cmake_path(REMOVE_EXTENSION _name)
+            string(TOUPPER "${_name}" _name_upper)
+
+            if(_kind STREQUAL "SOURCE")
+                set(_mode -s)
+            elseif(CONFIG_LUA_BYTECODE_IN_PLACE AND NOT CONFIG_LUA_BYTECODE_COMPRESS)
+                set(_mode -B)
+            else()
+                set(_mode -b)
+            endif()
+            if(CONFIG_${_name_upper}_LUA_GC_GENERATIONAL)
+                set(_gc -g)
+            else()
+                set(_gc -G)
+            endif()
+
+            set(_script "${CMAKE_CURRENT_SOURCE_DIR}/${_path}")
+            if(_kind STREQUAL "BYTECODE" AND CONFIG_LUA_OPTIMIZE)
+                add_custom_command(
+                    OUTPUT "${_opt_dir}/${_name}.lua"
+                    COMMAND ${PYTHON_EXECUTABLE} "${LUA_GENERATE_SCRIPT}"
+                        --mode optimize
+                        --output "${_opt_dir}/${_name}.lua"
+                        --name "${_name}"
+                        ${_gen_args}
+                        "${_script}"
+                    DEPENDS "${_script}"
+                    COMMENT "Optimizing ${_name}.lua for the heap profile"
+                )
+                set(_script "${_opt_dir}/${_name}.lua")
+                list(APPEND _args -L "${_opt_dir}")
+            endif()
+
+            list(APPEND _args ${_mode} ${_gc} -l ${_libs}
+                -p ${CONFIG_${_name_upper}_LUA_GC_PAUSE}
+                -k ${CONFIG_${_name_upper}_LUA_GC_STEPMUL}
+                -z ${CONFIG_${_name_upper}_LUA_GC_STEPSIZE}
+                "${_script}")
+            list(APPEND _deps "${_script}")
+        endforeach()
+    endforeach()
+
+    if(_args STREQUAL "")
+        return()
+    endif()
+
+    set(_output "${CMAKE_BINARY_DIR}/luaz_heap_profile.conf")
+    add_custom_command(
+        OUTPUT "${_output}"
+        COMMAND "${LUAZ_HEAP_PROFILE_HOST}"
+            -o "${_output}"
+            -m ${CONFIG_LUA_HEAP_PROFILE_MARGIN}
+            ${_args}
+        DEPENDS ${_deps}
+        COMMENT "Profiling Lua thread heaps into luaz_heap_profile.conf"
+    )
+
+    add_custom_target(luaz_heap_profile ALL DEPENDS "${_output}")
+    add_dependencies(luaz_heap_profile luaz_heap_profile_host)
 endfunction()
@@ -0,0 +1,13 @@
+--- FS thread of the startup benchmark.
+--- Startup ends at the first instruction; the rest only has to run.
+
+local zephyr = require("zephyr")
+
+local settings = { period_ms = 100, retries = 3 }
+local total = 0
+
+for i = 1, settings.retries do
+	total = total + i * settings.period_ms
+end
+
+zephyr.printk("boot_fs: ran (" .. total .. ")")
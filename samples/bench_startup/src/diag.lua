@@ -0,0 +1,14 @@
+--- Short diagnostic script run by the startup benchmark.
+--- Marks the point where it can do work, after its requires, then leaves a
+--- global behind: a pooled state must come back without it, so `runs` is
+--- 1 on every run.
+
+local mark = ...
+
+local zephyr = require("zephyr")
+
+mark()
+
+runs = (runs or 0) + 1
+
+return runs, zephyr.uptime_ms()
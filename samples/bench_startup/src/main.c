@@ -0,0 +1,210 @@
+/**
+ * @file main.c
+ * @brief Lua state startup benchmark: generated threads, fresh states and
+ *        the state pool.
+ *
+ * First waits for the source, bytecode and (with BENCH_STARTUP_FS) FS
+ * threads to reach their scripts' first instruction, prints their
+ * CONFIG_LUA_STARTUP_TRACE phases and checks each against
+ * CONFIG_BENCH_STARTUP_BUDGET_US.
+ *
+ * Then measures the cycles from "a script must run" to the point where
+ * the script has its libraries and can do work (after its require()s),
+ * once with a fresh heap, lua_newstate() and luaz_openlibs() per run, and
+ * once with luaz_state_acquire().  Also times what each path
+ * costs after the script: lua_close() versus the reset in
+ * luaz_state_release().
+ */
+
+#include <zephyr/kernel.h>
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <luaz_startup.h>
+#include <luaz_state_pool.h>
+#include <luaz_utils.h>
+
+#include "diag_lua_script.h"
+
+#ifdef CONFIG_LUA_FS
+#include <zephyr/fs/fs.h>
+#include <zephyr/fs/littlefs.h>
+#include <zephyr/storage/flash_map.h>
+#include <luaz_fs.h>
+
+#include "boot_fs_lua_script.h"
+
+FS_LITTLEFS_DECLARE_DEFAULT_CONFIG(storage);
+
+static struct fs_mount_t lua_lfs_mount = {
+	.type = FS_LITTLEFS,
+	.fs_data = &storage,
+	.storage_dev = (void *)FIXED_PARTITION_ID(storage_partition),
+	.mnt_point = CONFIG_LUA_FS_MOUNT_POINT,
+};
+
+/** @brief Mount LittleFS (formatting it if needed) and write boot_fs.lua. */
+static int prepare_fs(void)
+{
+	int rc = fs_mount(&lua_lfs_mount);
+
+	if (rc < 0) {
+		rc = fs_mkfs(FS_LITTLEFS, (uintptr_t)FIXED_PARTITION_ID(storage_partition), NULL,
+			     0);
+		if (rc == 0) {
+			rc = fs_mount(&lua_lfs_mount);
+		}
+		if (rc < 0) {
+			return rc;
+		}
+	}
+
+	return lua_fs_write_file("/lfs/boot_fs.lua", boot_fs_lua_script, 0);
+}
+#endif
+
+/** @brief Runs averaged per measurement. */
+#define RUNS 10
+
+static char heap_mem[CONFIG_LUA_STATE_POOL_HEAP_SIZE];
+static struct luaz_heap cold_heap;
+
+/** @brief Cycle count once the script has required its libraries. */
+static uint32_t script_ready;
+
+/** @brief Lua function passed to the script: mark() records script_ready. */
+static int mark(lua_State *L)
+{
+	ARG_UNUSED(L);
+
+	script_ready = k_cycle_get_32();
+
+	return 0;
+}
+
+/** @brief Run diag.lua in @p L; returns its `runs` result, or -1 on error. */
+static int run_diag(lua_State *L)
+{
+	if (luaL_loadstring(L, diag_lua_script) != LUA_OK) {
+		printk("Error: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
+		return -1;
+	}
+
+	lua_pushcfunction(L, mark);
+	if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+		printk("Error: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
+		return -1;
+	}
+
+	int runs = (int)lua_tointeger(L, -1);
+
+	lua_pop(L, 1);
+
+	return runs;
+}
+
+/**
+ * @brief Wait for every Lua thread to reach its first instruction, then
+ *        print its trace.
+ *
+ * @return true if all threads started within CONFIG_BENCH_STARTUP_BUDGET_US.
+ */
+static bool report_threads(void)
+{
+	int64_t deadline = k_uptime_get() + CONFIG_BENCH_STARTUP_TIMEOUT_MS;
+	bool ok = true;
+
+	STRUCT_SECTION_FOREACH(luaz_startup_trace, t) {
+		while (!t->done) {
+			if (k_uptime_get() > deadline) {
+				printk("Error: %s thread never started its script\n", t->name);
+				return false;
+			}
+			k_msleep(10);
+		}
+	}
+
+	STRUCT_SECTION_FOREACH(luaz_startup_trace, t) {
+		uint32_t us = k_cyc_to_us_floor32(luaz_startup_total(t));
+
+		luaz_startup_print(t);
+		if (us > CONFIG_BENCH_STARTUP_BUDGET_US) {
+			printk("startup regression: %s took %u us (budget %u us)\n", t->name, us,
+			       CONFIG_BENCH_STARTUP_BUDGET_US);
+			ok = false;
+		}
+	}
+
+	return ok;
+}
+
+/** @brief Print the average of @p total cycles over RUNS runs. */
+static void report(const char *what, uint64_t total)
+{
+	uint32_t cycles = (uint32_t)(total / RUNS);
+
+	printk("%s: %u cycles (%u us)\n", what, cycles, k_cyc_to_us_floor32(cycles));
+}
+
+int main(void)
+{
+	uint64_t cold = 0, closing = 0, pooled = 0, reset = 0;
+	bool ok = true;
+
+#ifdef CONFIG_LUA_FS
+	int rc = prepare_fs();
+
+	if (rc < 0) {
+		printk("Error: cannot prepare the filesystem: %d\n", rc);
+		return 0;
+	}
+#endif
+
+	/* The Lua threads run while this waits, before the timed loops below. */
+	printk("thread startup %s\n", report_threads() ? "within budget" : "FAILED");
+
+	for (int i = 0; i < RUNS; i++) {
+		uint32_t start = k_cycle_get_32();
+
+		luaz_heap_init(&cold_heap, "cold", heap_mem, sizeof(heap_mem));
+
+		lua_State *L = lua_newstate(lua_zephyr_allocator, &cold_heap, 0);
+
+		luaz_openlibs(L);
+		luaz_gc_configure(L, IS_ENABLED(CONFIG_LUA_GC_GENERATIONAL), CONFIG_LUA_GC_PAUSE,
+				  CONFIG_LUA_GC_STEPMUL, CONFIG_LUA_GC_STEPSIZE);
+		ok &= run_diag(L) == 1;
+		cold += script_ready - start;
+
+		start = k_cycle_get_32();
+		lua_close(L);
+		closing += k_cycle_get_32() - start;
+	}
+
+	for (int i = 0; i < RUNS; i++) {
+		uint32_t start = k_cycle_get_32();
+		lua_State *L = luaz_state_acquire(K_NO_WAIT);
+
+		if (L == NULL) {
+			printk("Error: no pooled state\n");
+			return 0;
+		}
+		ok &= run_diag(L) == 1;
+		pooled += script_ready - start;
+
+		start = k_cycle_get_32();
+		luaz_state_release(L);
+		reset += k_cycle_get_32() - start;
+	}
+
+	report("cold start", cold);
+	report("cold close", closing);
+	report("pooled start", pooled);
+	report("pooled reset", reset);
+	printk("pool reset %s\n", ok ? "ok" : "FAILED");
+	printk("startup benchmark finished\n");
+
+	return 0;
+}
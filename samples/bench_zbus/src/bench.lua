@@ -0,0 +1,205 @@
+--- zbus bindings benchmark: counts Lua heap allocations per message for
+--- each channel/observer method, then times table conversion on a 12-field
+--- telemetry channel.  alloc_count() and cycles() are registered by main.c.
+
+local zephyr = require("zephyr")
+local zbus = zephyr.zbus
+
+local chan_bench = zbus.channel_declare("chan_bench")
+local msub_bench = zbus.observer_declare("msub_bench")
+
+local N = 100
+local msg = { seq = 0, x = 1, y = 2, z = 3 }
+
+--- Print the average number of allocations per message for one method.
+--- @param name string    Method name.
+--- @param allocs integer Total allocations over N messages.
+local function report(name, allocs)
+    zephyr.printk(name .. ": " .. allocs // N .. " allocs/msg (" .. allocs .. " total)")
+end
+
+--- Warm-up round: interns field names and grows internal tables once.
+chan_bench:pub(msg, 100)
+msub_bench:wait_msg(100)
+chan_bench:read(100)
+
+local rx = {}
+chan_bench:read_into(rx, 100)
+chan_bench:pub(msg, 100)
+msub_bench:wait_msg_into(rx, 100)
+
+local pub_allocs, wait_allocs, wait_into_allocs = 0, 0, 0
+
+for i = 1, N do
+    msg.seq = i
+
+    local before = alloc_count()
+    chan_bench:pub(msg, 100)
+    pub_allocs = pub_allocs + alloc_count() - before
+
+    before = alloc_count()
+    msub_bench:wait_msg(100)
+    wait_allocs = wait_allocs + alloc_count() - before
+
+    chan_bench:pub(msg, 100)
+    before = alloc_count()
+    msub_bench:wait_msg_into(rx, 100)
+    wait_into_allocs = wait_into_allocs + alloc_count() - before
+end
+
+local before = alloc_count()
+for _ = 1, N do
+    chan_bench:read(100)
+end
+local read_allocs = alloc_count() - before
+
+before = alloc_count()
+for _ = 1, N do
+    chan_bench:read_into(rx, 100)
+end
+local read_into_allocs = alloc_count() - before
+
+--- Catch-up after bursts: queue BURST messages, then drain them at once.
+local BURST = 8
+local drained = {}
+
+for _ = 1, BURST do
+    chan_bench:pub(msg, 100)
+end
+msub_bench:drain(BURST, 100, drained)
+
+local drain_allocs = 0
+for _ = 1, N // BURST do
+    for _ = 1, BURST do
+        chan_bench:pub(msg, 100)
+    end
+    before = alloc_count()
+    msub_bench:drain(BURST, 100, drained)
+    drain_allocs = drain_allocs + alloc_count() - before
+end
+
+report("pub", pub_allocs)
+report("read", read_allocs)
+report("read_into", read_into_allocs)
+report("wait_msg", wait_allocs)
+report("wait_msg_into", wait_into_allocs)
+report("drain", drain_allocs)
+
+--- Conversion timing on the 12-field telemetry message.
+local chan_telemetry = zbus.channel_declare("chan_telemetry")
+local tm = {
+    timestamp = 0, seq = 0,
+    temperature = 21.5, humidity = 40.25, pressure = 1013.0,
+    accel_x = 1, accel_y = -2, accel_z = 981,
+    gyro_x = 3, gyro_y = -4, gyro_z = 5,
+    battery_mv = 3700,
+}
+local tr = {}
+local _, tv = chan_telemetry:view(100)
+
+--- Print the average number of cycles per message for one method.
+--- @param name string    Method name.
+--- @param cyc integer    Total cycles over N messages.
+local function report_cycles(name, cyc)
+    zephyr.printk(name .. ": " .. cyc // N .. " cycles/msg")
+end
+
+chan_telemetry:pub(tm, 100)
+chan_telemetry:read_into(tr, 100)
+
+local start = cycles()
+for i = 1, N do
+    tm.seq = i
+    chan_telemetry:pub(tm, 100)
+end
+local pub_cycles = (cycles() - start) & 0xffffffff
+
+start = cycles()
+for _ = 1, N do
+    chan_telemetry:read_into(tr, 100)
+end
+local read_into_cycles = (cycles() - start) & 0xffffffff
+
+start = cycles()
+for _ = 1, N do
+    chan_telemetry:read(100)
+end
+local read_cycles = (cycles() - start) & 0xffffffff
+
+--- Same messages as the pub timing, sent in batches of BATCH.
+local BATCH = 20
+local batch = {}
+for b = 1, BATCH do
+    batch[b] = tm
+end
+
+start = cycles()
+for _ = 1, N // BATCH do
+    chan_telemetry:pub_many(batch, 100)
+end
+local pub_many_cycles = (cycles() - start) & 0xffffffff
+
+--- Forward pattern: read two fields and republish the rest untouched.
+local view_allocs = 0
+start = cycles()
+for _ = 1, N do
+    local before = alloc_count()
+    chan_telemetry:view(100, tv)
+    tv.seq = tv.seq + tv.battery_mv % 2
+    chan_telemetry:pub(tv, 100)
+    view_allocs = view_allocs + alloc_count() - before
+end
+local view_cycles = (cycles() - start) & 0xffffffff
+
+--- In-place update under a claim: no copy of the message at all.
+--- @param v zbus_view  Claim view on the channel's own message.
+local function bump(v)
+    v.seq = v.seq + 1
+end
+
+chan_telemetry:with_claim(100, bump)
+
+local claim_allocs = 0
+start = cycles()
+for _ = 1, N do
+    local before = alloc_count()
+    chan_telemetry:with_claim(100, bump)
+    claim_allocs = claim_allocs + alloc_count() - before
+end
+local claim_cycles = (cycles() - start) & 0xffffffff
+
+--- Listener path: publish, then let the event loop run the callback.
+local listened = 0
+
+--- @param _ zbus_channel  Notified channel.
+--- @param m table         Latest message (same table on every call).
+local function on_telemetry(_, m)
+    listened = listened + m.seq % 2
+end
+
+zbus.listen(chan_telemetry, on_telemetry)
+chan_telemetry:pub(tm, 100)
+zephyr.run(0)
+
+local listen_allocs = 0
+start = cycles()
+for _ = 1, N do
+    chan_telemetry:pub(tm, 100)
+    local before = alloc_count()
+    zephyr.run(0)
+    listen_allocs = listen_allocs + alloc_count() - before
+end
+local listen_cycles = (cycles() - start) & 0xffffffff
+
+report("view", view_allocs)
+report("with_claim", claim_allocs)
+report("listen", listen_allocs)
+report_cycles("telemetry pub", pub_cycles)
+report_cycles("telemetry pub_many", pub_many_cycles)
+report_cycles("telemetry read_into", read_into_cycles)
+report_cycles("telemetry read", read_cycles)
+report_cycles("telemetry view", view_cycles)
+report_cycles("telemetry with_claim", claim_cycles)
+report_cycles("telemetry listen", listen_cycles)
+
+zephyr.printk("zbus benchmark finished")
@@ -0,0 +1,128 @@
+/**
+ * @file main.c
+ * @brief zbus bindings benchmark: allocations and cycles per message.
+ *
+ * Runs the embedded bench.lua script in a Lua state whose allocator counts
+ * every (re)allocation, so the script can report how many heap allocations
+ * each zbus method performs per message.  A 12-field telemetry channel is
+ * used to time the descriptor conversion with the cycle counter.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/zbus/zbus.h>
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+#include <luaz_msg_descr.h>
+#include <luaz_utils.h>
+
+#include "bench_lua_script.h"
+
+struct bench_msg {
+	int32_t seq;
+	int32_t x;
+	int32_t y;
+	int32_t z;
+};
+
+static const struct lua_msg_field_descr bench_msg_fields[] = {
+	LUA_MSG_FIELD(struct bench_msg, seq, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct bench_msg, x, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct bench_msg, y, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct bench_msg, z, LUA_MSG_TYPE_INT),
+};
+
+ZBUS_CHAN_DEFINE(chan_bench, struct bench_msg, NULL,
+		 LUA_ZBUS_MSG_DESCR(struct bench_msg, bench_msg_fields), ZBUS_OBSERVERS_EMPTY,
+		 ZBUS_MSG_INIT(0));
+
+struct telemetry_msg {
+	uint32_t timestamp;
+	uint16_t seq;
+	float temperature;
+	float humidity;
+	float pressure;
+	int16_t accel_x;
+	int16_t accel_y;
+	int16_t accel_z;
+	int16_t gyro_x;
+	int16_t gyro_y;
+	int16_t gyro_z;
+	uint16_t battery_mv;
+};
+
+static const struct lua_msg_field_descr telemetry_msg_fields[] = {
+	LUA_MSG_FIELD(struct telemetry_msg, timestamp, LUA_MSG_TYPE_UINT),
+	LUA_MSG_FIELD(struct telemetry_msg, seq, LUA_MSG_TYPE_UINT),
+	LUA_MSG_FIELD(struct telemetry_msg, temperature, LUA_MSG_TYPE_NUMBER),
+	LUA_MSG_FIELD(struct telemetry_msg, humidity, LUA_MSG_TYPE_NUMBER),
+	LUA_MSG_FIELD(struct telemetry_msg, pressure, LUA_MSG_TYPE_NUMBER),
+	LUA_MSG_FIELD(struct telemetry_msg, accel_x, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct telemetry_msg, accel_y, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct telemetry_msg, accel_z, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct telemetry_msg, gyro_x, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct telemetry_msg, gyro_y, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct telemetry_msg, gyro_z, LUA_MSG_TYPE_INT),
+	LUA_MSG_FIELD(struct telemetry_msg, battery_mv, LUA_MSG_TYPE_UINT),
+};
+
+ZBUS_CHAN_DEFINE(chan_telemetry, struct telemetry_msg, NULL,
+		 LUA_ZBUS_MSG_DESCR(struct telemetry_msg, telemetry_msg_fields),
+		 ZBUS_OBSERVERS_EMPTY, ZBUS_MSG_INIT(0));
+
+ZBUS_MSG_SUBSCRIBER_DEFINE(msub_bench);
+
+ZBUS_CHAN_ADD_OBS(chan_bench, msub_bench, 3);
+
+static char heap_mem[CONFIG_LUA_THREAD_HEAP_SIZE];
+static struct luaz_heap lua_heap;
+
+/** @brief Number of allocator calls that returned (or resized) a block. */
+static uint32_t alloc_count;
+
+/** @brief Counting wrapper around the luaz_heap Lua allocator. */
+static void *bench_allocator(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	if (nsize > 0) {
+		alloc_count++;
+	}
+
+	return lua_zephyr_allocator(ud, ptr, osize, nsize);
+}
+
+/** @brief Lua function: alloc_count() -> number of allocations so far. */
+static int alloc_count_get(lua_State *L)
+{
+	lua_pushinteger(L, alloc_count);
+	return 1;
+}
+
+/** @brief Lua function: cycles() -> current 32-bit hardware cycle count. */
+static int cycles_get(lua_State *L)
+{
+	lua_pushinteger(L, k_cycle_get_32());
+	return 1;
+}
+
+int main(void)
+{
+	luaz_heap_init(&lua_heap, "bench_zbus", heap_mem, CONFIG_LUA_THREAD_HEAP_SIZE);
+
+	lua_State *L = lua_newstate(bench_allocator, &lua_heap, 0);
+
+	luaz_openlibs(L);
+	lua_register(L, "alloc_count", alloc_count_get);
+	lua_register(L, "cycles", cycles_get);
+
+	if (luaL_dostring(L, bench_lua_script) != LUA_OK) {
+		printk("Error: %s\n", lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+
+	lua_close(L);
+
+	luaz_print_mem_usage(&lua_heap, CONFIG_LUA_THREAD_HEAP_SIZE);
+
+	return 0;
+}
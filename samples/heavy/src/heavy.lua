@@ -1,6 +1,8 @@
 local zephyr = require("zephyr")
 local string = require("string")
 
+local start_ms = zephyr.uptime_ms()
+
 for i = 1, 10 do
 	local name = "func_" .. i
 	_ENV[name] = function()
@@ -45,4 +47,24 @@ for i = 1, 10 do
 	results[i] = _ENV[name]()
 end
 
-zephyr.printk("Heavy load sample finished")
+local elapsed_ms = zephyr.uptime_ms() - start_ms
+local stats = zephyr.mem_stats()
+zephyr.printk("Lua heap peak: " .. stats.peak .. " bytes, " .. stats.allocs .. " allocs")
+zephyr.printk("Heavy load sample finished in " .. elapsed_ms .. " ms")
+
+-- A tight limit: garbage churn far beyond the headroom must stay under it
+local _, in_use = zephyr.mem_limit()
+local limit = zephyr.mem_limit(in_use + 4096)
+local peak = 0
+for _ = 1, 200 do
+	local t = {}
+	for k = 1, 32 do
+		t[k] = k
+	end
+	local _, now = zephyr.mem_limit()
+	if now > peak then
+		peak = now
+	end
+end
+zephyr.mem_limit(0)
+zephyr.printk("Lua heap limit " .. (peak <= limit and "enforced" or "exceeded"))
@@ -0,0 +1,39 @@
+# SPDX-License-Identifier: Apache-2.0
+
+"""Leave the Lua REPL with Ctrl+D, then list the Lua heaps with lua_mem."""
+
+import re
+
+from twister_harness import DeviceAdapter, Shell
+
+EOT = b"\x04"
+
+
+def heap_rows(lines):
+    """Heap names of the rows of the lua_mem table."""
+    return [line.split()[0] for line in lines if re.match(r"^\S+\s+\d+\s+\d+\s+\d+", line)]
+
+
+def run_repl(dut: DeviceAdapter, shell: Shell):
+    dut.write(b"lua\n")
+    dut.readlines_until(regex="Press Ctrl\\+D to exit", timeout=10)
+    dut.write(b"1 + 1\n")
+    dut.readlines_until(regex="^2$", timeout=10)
+    dut.write(EOT)
+    shell.wait_for_prompt()
+
+
+def test_lua_mem_after_repl_exit(dut: DeviceAdapter, shell: Shell):
+    before = heap_rows(shell.exec_command("lua_mem"))
+
+    # Twice: the second run re-initializes the heap already in the list
+    for _ in range(2):
+        run_repl(dut, shell)
+
+        lines = shell.exec_command("lua_mem")
+        rows = heap_rows(lines)
+        assert "repl" in rows, lines
+        assert set(before) <= set(rows), lines
+
+        detail = shell.exec_command("lua_mem repl")
+        assert any(re.match(r"^repl: \d+/\d+ bytes in use", line) for line in detail), detail
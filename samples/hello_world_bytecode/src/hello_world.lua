@@ -1,6 +1,7 @@
 local z = require("zephyr")
+local greeting = require("greeting")
 
-z.printk("Hello from lua thread")
+greeting.hello("lua thread")
 z.log_err("This is an error log")
 z.log_dbg("This is a debug log")
 z.log_inf("This is an info log")
@@ -0,0 +1,9 @@
+local z = require("zephyr")
+
+local greeting = {}
+
+function greeting.hello(who)
+	z.printk("Hello from " .. who)
+end
+
+return greeting
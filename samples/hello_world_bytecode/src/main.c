@@ -9,6 +9,7 @@
 #include <lauxlib.h>
 #include <lua.h>
 #include <lualib.h>
+#include <luaz_bytecode.h>
 #include <luaz_utils.h>
 
 #include "sample01_lua_bytecode.h"
@@ -20,8 +21,8 @@ int main(int argc, char *argv[])
 
 	luaz_openlibs(L);
 
-	if (luaL_loadbuffer(L, (const char *)sample01_lua_bytecode, sample01_lua_bytecode_len,
-			    "sample01") != LUA_OK ||
+	if (luaz_load_bytecode(L, sample01_lua_bytecode, sample01_lua_bytecode_len,
+			       "sample01") != LUA_OK ||
 	    lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK) {
 		printk("Error: %s\n", lua_tostring(L, -1));
 		lua_pop(L, 1);
@@ -13,5 +13,6 @@ ZBUS_CHAN_DECLARE(chan_acc_data);
 ZBUS_CHAN_DECLARE(chan_acc_data_consumed);
 ZBUS_CHAN_DECLARE(chan_version);
 ZBUS_CHAN_DECLARE(chan_sensor_config);
+ZBUS_CHAN_DECLARE(chan_acc_burst);
 
 #endif /* !CHANNELS_H */
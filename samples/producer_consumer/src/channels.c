@@ -35,6 +35,12 @@ ZBUS_CHAN_DEFINE(chan_sensor_config, struct msg_sensor_config, NULL,
 		ZBUS_OBSERVERS_EMPTY,
 		ZBUS_MSG_INIT(.sensor_id = 0, .offset = {0}));
 
+LUA_PB_DESCR_DEFINE(msg_acc_burst);
+ZBUS_CHAN_DEFINE(chan_acc_burst, struct msg_acc_burst, NULL,
+		LUA_PB_DESCR_REF(msg_acc_burst),
+		ZBUS_OBSERVERS_EMPTY,
+		ZBUS_MSG_INIT(0));
+
 /* clang-format on */
 
 ZBUS_MSG_SUBSCRIBER_DEFINE(msub_acc_consumed);
@@ -7,6 +7,7 @@ local zbus = zephyr.zbus
 local chan_version = zbus.channel_declare("chan_version")
 local chan_sensor_config = zbus.channel_declare("chan_sensor_config")
 local chan_acc_data = zbus.channel_declare("chan_acc_data")
+local chan_acc_burst = zbus.channel_declare("chan_acc_burst")
 local msub_acc_consumed = zbus.observer_declare("msub_acc_consumed")
 
 --- Read and display the system version from the version channel.
@@ -29,6 +30,72 @@ if err == 0 then
     end
 end
 
+--- Publish a whole 32-sample accelerometer burst as one message (repeated
+--- fields become Lua sequences), then read it back and check the samples.
+local burst = { x = {}, y = {}, z = {} }
+for s = 1, 32 do
+    burst.x[s] = s
+    burst.y[s] = -s
+    burst.z[s] = 2 * s
+end
+err = chan_acc_burst:pub(burst, 200)
+if err == 0 then
+    err, msg = chan_acc_burst:read(200)
+    if msg then
+        local sum = 0
+        for s = 1, #msg.x do
+            sum = sum + msg.x[s] + msg.y[s] + msg.z[s]
+        end
+        zephyr.printk("Acc_burst={samples=" .. #msg.x .. " sum=" .. sum .. "}")
+    end
+end
+
+--- Re-enter zbus from __gc finalizers while bursts are converted: reading a
+--- burst allocates its tables, which runs GC steps and so the finalizers.
+--- Their nested pub/read must not overwrite the burst being decoded.
+local finalized, corrupted = 0, 0
+local reenter = { __gc = function()
+    finalized = finalized + 1
+    chan_sensor_config:pub({ sensor_id = -1 }, 0)
+    chan_sensor_config:read(0)
+end }
+for _ = 1, 50 do
+    for _ = 1, 8 do
+        setmetatable({}, reenter)
+    end
+    chan_acc_burst:pub(burst, 200)
+    err, msg = chan_acc_burst:read(200)
+    local sum = 0
+    for s = 1, #msg.x do
+        sum = sum + msg.x[s] + msg.y[s] + msg.z[s]
+    end
+    if err ~= 0 or sum ~= 1056 then
+        corrupted = corrupted + 1
+    end
+end
+collectgarbage()
+zephyr.printk("Reentrant zbus: " .. finalized .. " finalizers, " .. corrupted .. " corrupted")
+
+--- Fields missing from a published table come from an __index defaults
+--- table, nested objects included. An __index function is never called
+--- while the message is built, so it cannot re-enter zbus mid-conversion.
+local defaults = { sensor_id = 7, offset = { x = 4, y = 5, z = 6 } }
+chan_sensor_config:pub(setmetatable({}, { __index = defaults }), 200)
+err, msg = chan_sensor_config:read(200)
+local from_defaults = msg
+local calls = 0
+local guarded = setmetatable({ offset = { x = 1, y = 2, z = 3 } }, { __index = function()
+    calls = calls + 1
+    chan_sensor_config:pub({ sensor_id = -1 }, 0)
+    return 9
+end })
+chan_sensor_config:pub(guarded, 200)
+err, msg = chan_sensor_config:read(200)
+zephyr.printk("Index defaults: sensor_id=" .. from_defaults.sensor_id
+    .. " offset.x=" .. from_defaults.offset.x
+    .. " guarded=" .. tostring(msg.sensor_id)
+    .. " calls=" .. calls)
+
 --- Linear congruential pseudo-random number generator.
 --- @param seed number  Input seed value.
 --- @return number      Pseudo-random value in [0, 7601].
@@ -73,5 +140,11 @@ while i < 10 do
         end
     end
 
+    --- Collect garbage in the idle time before the next sample.
+    zephyr.gc_step_budget(500)
+
     zephyr.msleep(200)
 end
+
+local steps, cycles = zephyr.idle_gc_stats()
+zephyr.printk("Idle GC: " .. steps .. " steps, " .. cycles .. " cycles")
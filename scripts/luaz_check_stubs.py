@@ -0,0 +1,72 @@
+"""Check that the heap profiler stubs cover the target Lua bindings.
+
+host_tools/luaz_heap_profile.c stands in for the zephyr and zbus libraries
+with stubs.  A binding added on the target but not stubbed makes every
+profiled script that uses it fail with "attempt to call a nil value", so
+this compares the luaL_Reg arrays of both sides by name and fails on any
+difference.
+
+Usage:
+  luaz_check_stubs.py <module dir>
+"""
+
+import os
+import re
+import sys
+
+# (stub array, target source, target array, compare metamethods too)
+PAIRS = [
+    ("chan_methods", "src/luaz_zbus.c", "zbus_chan_metamethods", False),
+    ("obs_methods", "src/luaz_zbus.c", "zbus_obs_metamethods", False),
+    ("view_metamethods", "src/luaz_zbus.c", "zbus_view_metamethods", True),
+    ("zbus_lib", "src/luaz_zbus.c", "zbus", False),
+    ("zephyr_lib", "src/luaz_utils.c", "zephyr_wrappers", False),
+]
+
+STUB_SOURCE = "host_tools/luaz_heap_profile.c"
+
+
+def reg_names(path, array):
+    """Return the names registered in the luaL_Reg array of a C file.
+
+    Entries under #ifdef are included: the stubs cover every configuration.
+    """
+    with open(path, "r") as f:
+        text = f.read()
+
+    m = re.search(
+        r"luaL_Reg\s+" + re.escape(array) + r"\s*\[\]\s*=\s*\{(.*?)\};", text, re.S
+    )
+    if m is None:
+        sys.exit(f"luaz_check_stubs: no luaL_Reg array '{array}' in {path}")
+
+    return set(re.findall(r'\{\s*"(\w+)"\s*,', m.group(1)))
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__.strip().splitlines()[-1].strip())
+
+    root = sys.argv[1]
+    errors = []
+
+    for stub, source, target, metamethods in PAIRS:
+        have = reg_names(os.path.join(root, STUB_SOURCE), stub)
+        want = reg_names(os.path.join(root, source), target)
+        if not metamethods:
+            have = {n for n in have if not n.startswith("__")}
+            want = {n for n in want if not n.startswith("__")}
+
+        for name in sorted(want - have):
+            errors.append(f"{target} has '{name}' but {stub} does not")
+        for name in sorted(have - want):
+            errors.append(f"{stub} has '{name}' but {target} does not")
+
+    for error in errors:
+        print(f"luaz_check_stubs: {STUB_SOURCE}: {error}", file=sys.stderr)
+
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
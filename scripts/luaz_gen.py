@@ -1,15 +1,37 @@
 """Generate C source/header files from Lua scripts using templates.
 
-Supports two modes:
+Supports four modes:
   source   - Escapes a .lua file into a C string and substitutes into a template.
   bytecode - Compiles a .lua file to bytecode via luac -s and substitutes the
              resulting byte array into a template.
+  bundle   - Compiles several .lua files and substitutes the module archive
+             described in include/luaz_bundle.h into a template. Each module
+             is named after its file, without the last extension.
+  optimize - Writes the luaz_opt output of a .lua file as Lua source, and
+             the functions split out by --lazy next to it, module "a:b" as
+             a.b.lua. No template; luaz_heap_profile runs these so that it
+             profiles the script the target runs.
 
 Template placeholders:
   @FILE_NAME@        - Base name of the Lua script (without extension)
   @LUA_CONTENT@      - (source mode) C-escaped script contents
-  @LUA_BYTECODE@     - (bytecode mode) Comma-separated hex bytes
-  @LUA_BYTECODE_LEN@ - (bytecode mode) Byte count
+  @LUA_BYTECODE@     - (bytecode/bundle mode) Comma-separated hex bytes
+  @LUA_BYTECODE_LEN@ - (bytecode/bundle mode) Byte count
+  @LUA_LAZY_BUNDLE@  - (bytecode mode) Bundle of the functions split out by
+                       --lazy, or nothing
+
+With --compress, bytecode is packed into the LZSS stream that
+luaz_load_bytecode() decodes when CONFIG_LUA_BYTECODE_COMPRESS is enabled:
+
+  "\\x1bLZ\\x01", uncompressed size (u32 LE), then groups of one flag byte
+  (LSB first, 1 = literal) and up to eight items: a literal byte, or a
+  u16 LE match of (length - LZ_MIN_MATCH) << 10 | (distance - 1).
+
+With --optimize, the script is first rewritten by luaz_opt.py (constant
+locals, hoisted module lookups, dead branches behind --define NAME=VALUE,
+unused local functions). With --lazy as well, large chunk-level functions
+are compiled as separate modules "<name>:<function>" that are loaded on
+their first call; they go into a bundle next to the script's bytecode.
 
 Replaces lua_cat.py and lua_compile.py with a single script that writes the
 final output file directly, enabling CMake add_custom_command dependency
@@ -18,10 +40,23 @@ tracking on the .lua source.
 
 import argparse
 import os
+import struct
 import subprocess
 import sys
 import tempfile
 
+import luaz_opt
+
+# Keep in sync with src/luaz_bytecode.c.
+LZ_MAGIC = b"\x1bLZ\x01"
+LZ_WINDOW = 1024
+LZ_MIN_MATCH = 3
+LZ_MAX_MATCH = LZ_MIN_MATCH + 63
+
+# Keep in sync with src/luaz_bundle.c and include/luaz_bytecode.h.
+BUNDLE_MAGIC = b"LZB\x01"
+BUNDLE_ALIGN = 8
+
 
 def lua_to_c_string(path):
     """Read a .lua file and return a C-escaped string literal body."""
@@ -37,8 +72,84 @@ def lua_to_c_string(path):
     return " \\\n".join(strings)
 
 
-def lua_to_bytecode(luac, path):
-    """Compile a .lua file and return (length, hex_bytes) strings."""
+def lz_compress(data):
+    """Compress data into the LZSS stream described in the module docstring."""
+    out = bytearray(LZ_MAGIC + struct.pack("<I", len(data)))
+    chains = {}
+    flags_at = None
+    nitems = 0
+    pos = 0
+
+    while pos < len(data):
+        if nitems % 8 == 0:
+            flags_at = len(out)
+            out.append(0)
+
+        best_len, best_dist = 0, 0
+        limit = min(LZ_MAX_MATCH, len(data) - pos)
+        for cand in reversed(chains.get(data[pos : pos + LZ_MIN_MATCH], ())):
+            dist = pos - cand
+            if dist > LZ_WINDOW:
+                break
+            length = 0
+            while length < limit and data[cand + length] == data[pos + length]:
+                length += 1
+            if length > best_len:
+                best_len, best_dist = length, dist
+                if length == limit:
+                    break
+
+        if best_len >= LZ_MIN_MATCH:
+            token = (best_len - LZ_MIN_MATCH) << 10 | (best_dist - 1)
+            out += struct.pack("<H", token)
+            step = best_len
+        else:
+            out[flags_at] |= 1 << (nitems % 8)
+            out.append(data[pos])
+            step = 1
+
+        for i in range(pos, pos + step):
+            chains.setdefault(data[i : i + LZ_MIN_MATCH], []).append(i)
+        pos += step
+        nitems += 1
+
+    return bytes(out)
+
+
+def optimize_lua(path, name, defines, lazy):
+    """Run luaz_opt over a .lua file; return (source, {lazy module: source})."""
+    with open(path, "r") as f:
+        script = f.read()
+
+    try:
+        script, stats, modules = luaz_opt.optimize(
+            script, defines, name if lazy else None
+        )
+    except ValueError as e:
+        print(f"luaz_opt: {path}: {e}", file=sys.stderr)
+        sys.exit(1)
+
+    summary = ", ".join(f"{v} {k.replace('_', ' ')}" for k, v in stats.items())
+    print(f"{name}: optimized: {summary}")
+
+    return script, modules
+
+
+def write_optimized(path, output, name, defines, lazy):
+    """Write the optimized source of @p path and its lazy modules as .lua files."""
+    script, modules = optimize_lua(path, name, defines, lazy)
+    out_dir = os.path.dirname(output)
+    os.makedirs(out_dir, exist_ok=True)
+
+    with open(output, "w") as f:
+        f.write(script)
+    for module, text in modules.items():
+        with open(os.path.join(out_dir, module.replace(":", ".") + ".lua"), "w") as f:
+            f.write(text)
+
+
+def run_luac(luac, path):
+    """Compile a .lua file with luac -s and return the bytecode."""
     with tempfile.NamedTemporaryFile(suffix=".luac", delete=False) as tmp:
         tmp_path = tmp.name
 
@@ -53,38 +164,173 @@ def lua_to_bytecode(luac, path):
             sys.exit(1)
 
         with open(tmp_path, "rb") as f:
-            data = f.read()
-
-        byte_count = str(len(data))
-        hex_bytes = ", ".join(f"0x{b:02x}" for b in data)
-        return byte_count, hex_bytes
+            return f.read()
     finally:
         os.unlink(tmp_path)
 
 
+def maybe_compress(data, name, compress):
+    """Return data, LZSS-compressed if requested."""
+    if not compress:
+        return data
+
+    packed = lz_compress(data)
+    print(
+        f"{name}: bytecode compressed {len(data)} -> {len(packed)} bytes "
+        f"({len(data) - len(packed)} bytes saved)"
+    )
+    return packed
+
+
+def compile_source(luac, script, name, compress):
+    """Compile Lua source text and return its (possibly compressed) bytecode."""
+    with tempfile.NamedTemporaryFile(
+        "w", suffix=".lua", prefix=f"{name.replace(':', '_')}_", delete=False
+    ) as tmp:
+        tmp.write(script)
+        src_path = tmp.name
+
+    try:
+        data = run_luac(luac, src_path)
+    finally:
+        os.unlink(src_path)
+
+    return maybe_compress(data, name, compress)
+
+
+def compile_lua(
+    luac, path, name, compress=False, optimize=False, defines=None, lazy=False
+):
+    """Compile a .lua file.
+
+    Returns its (possibly compressed) bytecode and {module: bytecode} for
+    the functions split out by --lazy.
+    """
+    if not optimize:
+        return maybe_compress(run_luac(luac, path), name, compress), {}
+
+    script, modules = optimize_lua(path, name, defines, lazy)
+    data = compile_source(luac, script, name, compress)
+    lazy_modules = {
+        module: compile_source(luac, text, module, compress)
+        for module, text in modules.items()
+    }
+
+    return data, lazy_modules
+
+
+def lazy_bundle_c(name, modules):
+    """C definition of the bundle holding a script's lazy functions."""
+    if not modules:
+        return ""
+
+    byte_count, hex_bytes = to_c_bytes(make_bundle(modules))
+    return (
+        f"static const uint8_t {name}_lazy_lua_bundle[] "
+        f"__aligned(LUAZ_BYTECODE_ALIGN) = {{ {hex_bytes} }};\n"
+        f"LUAZ_BUNDLE_DEFINE({name}_lazy, {name}_lazy_lua_bundle, {byte_count});\n"
+    )
+
+
+def to_c_bytes(data):
+    """Return (length, hex_bytes) strings for a C array initializer."""
+    return str(len(data)), ", ".join(f"0x{b:02x}" for b in data)
+
+
+def make_bundle(modules):
+    """Pack {module name: bytecode} into a bundle archive.
+
+    The index is sorted by name as strcmp() orders it, and modules with
+    identical bytecode share one copy of it.
+    """
+    names = sorted(modules, key=lambda n: n.encode())
+    header_len = len(BUNDLE_MAGIC) + 4 + 12 * len(names)
+
+    name_area = bytearray()
+    name_offs = {}
+    for name in names:
+        name_offs[name] = header_len + len(name_area)
+        name_area += name.encode() + b"\0"
+
+    body = bytearray(name_area)
+    chunk_offs = {}
+    entries = []
+    for name in names:
+        data = modules[name]
+        if data not in chunk_offs:
+            body += bytes(-(header_len + len(body)) % BUNDLE_ALIGN)
+            chunk_offs[data] = header_len + len(body)
+            body += data
+        entries.append(struct.pack("<III", name_offs[name], chunk_offs[data], len(data)))
+
+    return BUNDLE_MAGIC + struct.pack("<I", len(names)) + b"".join(entries) + bytes(body)
+
+
 def main():
     parser = argparse.ArgumentParser(
         description="Generate C source/header from a Lua script and a template."
     )
     parser.add_argument(
         "--mode",
-        choices=["source", "bytecode"],
+        choices=["source", "bytecode", "bundle", "optimize"],
         required=True,
-        help="Processing mode: escape source or compile to bytecode",
+        help="Processing mode: escape source, compile to bytecode, bundle modules "
+        "or write the optimized source",
+    )
+    parser.add_argument(
+        "--template", help="Path to the .in template (all modes but optimize)"
     )
-    parser.add_argument("--template", required=True, help="Path to the .in template")
     parser.add_argument("--output", required=True, help="Path to the output file")
     parser.add_argument(
         "--name", required=True, help="Value for @FILE_NAME@ placeholder"
     )
     parser.add_argument(
-        "--luac", default=None, help="Path to host luac binary (bytecode mode)"
+        "--luac", default=None, help="Path to host luac binary (bytecode/bundle mode)"
+    )
+    parser.add_argument(
+        "--compress",
+        action="store_true",
+        help="LZSS-compress the bytecode (bytecode/bundle mode)",
+    )
+    parser.add_argument(
+        "--optimize",
+        action="store_true",
+        help="Run the luaz_opt source optimizer before luac (bytecode/bundle mode)",
+    )
+    parser.add_argument(
+        "--lazy",
+        action="store_true",
+        help="Split large functions into modules loaded on first call (with --optimize)",
+    )
+    parser.add_argument(
+        "--define",
+        action="append",
+        default=[],
+        metavar="NAME=VALUE",
+        help="Replace reads of global NAME with the Lua literal VALUE (with --optimize)",
+    )
+    parser.add_argument(
+        "file", nargs="+", help="Lua script file to process (several in bundle mode)"
     )
-    parser.add_argument("file", help="Lua script file to process")
     args = parser.parse_args()
 
-    if args.mode == "bytecode" and args.luac is None:
-        parser.error("--luac is required in bytecode mode")
+    if args.mode != "optimize" and args.template is None:
+        parser.error(f"--template is required in {args.mode} mode")
+    if args.mode not in ("source", "optimize") and args.luac is None:
+        parser.error(f"--luac is required in {args.mode} mode")
+    if args.mode != "bundle" and len(args.file) != 1:
+        parser.error(f"{args.mode} mode takes a single file")
+
+    defines = {}
+    for define in args.define:
+        key, sep, value = define.partition("=")
+        if not sep or not key.isidentifier():
+            parser.error(f"--define expects NAME=VALUE, got '{define}'")
+        defines[key] = value
+
+    if args.mode == "optimize":
+        write_optimized(args.file[0], args.output, args.name, defines, args.lazy)
+        return
 
     with open(args.template, "r") as f:
         template = f.read()
@@ -93,10 +339,46 @@ def main():
     output = output.replace("@FILE_NAME_UPPER@", args.name.upper())
 
     if args.mode == "source":
-        content = lua_to_c_string(args.file)
+        content = lua_to_c_string(args.file[0])
         output = output.replace("@LUA_CONTENT@", content)
     else:
-        byte_count, hex_bytes = lua_to_bytecode(args.luac, args.file)
+        if args.mode == "bytecode":
+            data, lazy_modules = compile_lua(
+                args.luac,
+                args.file[0],
+                args.name,
+                args.compress,
+                args.optimize,
+                defines,
+                args.lazy,
+            )
+            output = output.replace(
+                "@LUA_LAZY_BUNDLE@", lazy_bundle_c(args.name, lazy_modules)
+            )
+        else:
+            modules = {}
+            for path in args.file:
+                module = os.path.splitext(os.path.basename(path))[0]
+                if module in modules:
+                    parser.error(f"module '{module}' is bundled twice")
+                modules[module], lazy_modules = compile_lua(
+                    args.luac,
+                    path,
+                    module,
+                    args.compress,
+                    args.optimize,
+                    defines,
+                    args.lazy,
+                )
+                modules.update(lazy_modules)
+            data = make_bundle(modules)
+            unique = len(set(modules.values()))
+            print(
+                f"{args.name}: bundled {len(modules)} modules "
+                f"({len(modules) - unique} shared) into {len(data)} bytes"
+            )
+
+        byte_count, hex_bytes = to_c_bytes(data)
         output = output.replace("@LUA_BYTECODE@", hex_bytes)
         output = output.replace("@LUA_BYTECODE_LEN@", byte_count)
 
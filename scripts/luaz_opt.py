@@ -0,0 +1,754 @@
+"""Source-level optimizer for Lua scripts compiled to bytecode.
+
+Lua compiles in a single pass with no intermediate representation, so the
+optimizations the host luac cannot do are applied here, on the token stream,
+before luaz_gen.py hands the script to luac:
+
+  defines    - Global names given with --define NAME=VALUE are replaced by
+               the VALUE literal wherever they are read.
+  dead code  - if/elseif clauses whose condition is a constant expression
+               are resolved: false clauses are removed, a true clause ends
+               the statement. `if DEBUG then ... end` with DEBUG defined to
+               false disappears from the bytecode.
+  unused     - `local function` definitions that are never referenced are
+               removed.
+  constants  - `local NAME = <literal>` that is never reassigned is marked
+               <const>, so luac folds it into every expression it is used
+               in and no register is spent on it.
+  hoisting   - Field chains rooted at a module local (`local m = require(...)`
+               never reassigned or written into) that are read inside loops or
+               functions, such as `zephyr.zbus.xxx`, are resolved once into a
+               local right after the require.
+  lazy       - (optional) Large chunk-level `function f` / `local function f`
+               that use no chunk locals other than module locals and literal
+               constants become modules "<chunk>:f". A stub left in their
+               place requires the module on the first call and replaces
+               itself with the real function.
+
+Every rewrite is skipped when the script does something the pass cannot
+prove safe (a shadowing declaration, an assignment, an indexed access).
+Removed code is replaced by its newlines, so the lines after it keep their
+numbers.
+
+Hoisting evaluates the field chain when the module is loaded: code that
+replaces a module field at run time and expects other scripts to see the
+new value must not be compiled with it.
+"""
+
+import re
+
+KEYWORDS = {
+    "and", "break", "do", "else", "elseif", "end", "false", "for",
+    "function", "goto", "if", "in", "local", "nil", "not", "or",
+    "repeat", "return", "then", "true", "until", "while",
+}
+
+OPENERS = {"function", "if", "do", "repeat"}
+CLOSERS = {"end", "until"}
+
+# Upper bound on hoisted locals, well below Lua's 200 locals per function.
+MAX_HOISTS = 32
+
+# Smallest function (in tokens) worth a separate lazily loaded chunk.
+LAZY_MIN_TOKENS = 48
+
+_TOKEN_RE = re.compile(
+    r"""
+    (?P<ws>\s+)
+  | (?P<comment>--\[(?P<ceq>=*)\[.*?\](?P=ceq)\]|--[^\n]*)
+  | (?P<string>\[(?P<seq>=*)\[.*?\](?P=seq)\]
+             |"(?:\\.|\\\n|[^"\\\n])*"
+             |'(?:\\.|\\\n|[^'\\\n])*')
+  | (?P<number>0[xX](?:[0-9a-fA-F]*\.?[0-9a-fA-F]+|[0-9a-fA-F]+\.)(?:[pP][+-]?\d+)?
+             |(?:\d+\.?\d*|\.\d+)(?:[eE][+-]?\d+)?)
+  | (?P<name>[A-Za-z_][A-Za-z0-9_]*)
+  | (?P<op>\.\.\.|\.\.|==|~=|<=|>=|<<|>>|//|::|[-+*/%^\#&~|<>=(){}\[\];:,.])
+    """,
+    re.VERBOSE | re.DOTALL,
+)
+
+
+class Tok:
+    """A token; whitespace and comments are kept so the source round-trips."""
+
+    __slots__ = ("kind", "text")
+
+    def __init__(self, kind, text):
+        self.kind = kind
+        self.text = text
+
+    def __repr__(self):
+        return f"Tok({self.kind}, {self.text!r})"
+
+    @property
+    def trivia(self):
+        return self.kind in ("ws", "comment")
+
+
+def tokenize(src):
+    """Split Lua source into tokens; raise ValueError on anything unknown."""
+    toks = []
+    pos = 0
+    if src.startswith("#"):
+        end = src.find("\n")
+        end = len(src) if end < 0 else end
+        toks.append(Tok("comment", src[:end]))
+        pos = end
+    while pos < len(src):
+        m = _TOKEN_RE.match(src, pos)
+        if m is None:
+            raise ValueError(f"cannot tokenize at offset {pos}")
+        kind = m.lastgroup
+        if kind in ("ceq", "seq"):
+            kind = "comment" if m.group("comment") else "string"
+        text = m.group(0)
+        if kind == "name" and text in KEYWORDS:
+            kind = "kw"
+        toks.append(Tok(kind, text))
+        pos = m.end()
+    return toks
+
+
+def untokenize(toks):
+    return "".join(t.text for t in toks)
+
+
+def _blank(text):
+    """Replacement for removed code: keep its newlines, drop the rest."""
+    n = text.count("\n")
+    return Tok("ws", "\n" * n if n else " ")
+
+
+class Script:
+    """Significant-token view of a token list, rebuilt after each rewrite."""
+
+    def __init__(self, toks):
+        self.toks = toks
+        self.sig = [i for i, t in enumerate(toks) if not t.trivia]
+
+    def __len__(self):
+        return len(self.sig)
+
+    def tok(self, j):
+        if 0 <= j < len(self.sig):
+            return self.toks[self.sig[j]]
+        return Tok("eof", "")
+
+    def text(self, j):
+        return self.tok(j).text
+
+    def is_name(self, j, name=None):
+        t = self.tok(j)
+        return t.kind == "name" and (name is None or t.text == name)
+
+    def is_ref(self, j):
+        """Name token used as a variable (not a field, method or label)."""
+        return self.is_name(j) and self.text(j - 1) not in (".", ":", "::", "goto")
+
+    def match_block(self, j):
+        """Index of the end/until closing the block opened at j."""
+        depth = 0
+        k = j
+        while k < len(self):
+            t = self.tok(k)
+            if t.kind == "kw":
+                if t.text in OPENERS:
+                    depth += 1
+                elif t.text in CLOSERS:
+                    depth -= 1
+                    if depth == 0:
+                        return k
+            k += 1
+        return None
+
+    def match_bracket(self, j):
+        """Index of the bracket closing the one opened at j."""
+        pairs = {"(": ")", "[": "]", "{": "}"}
+        stack = []
+        for k in range(j, len(self)):
+            t = self.text(k)
+            if self.tok(k).kind != "op":
+                continue
+            if t in pairs:
+                stack.append(pairs[t])
+            elif stack and t == stack[-1]:
+                stack.pop()
+                if not stack:
+                    return k
+        return None
+
+    def in_braces(self):
+        """Per token: True when directly inside a table constructor."""
+        result = []
+        stack = []
+        for j in range(len(self)):
+            t = self.tok(j)
+            result.append(bool(stack) and stack[-1] == "{")
+            if t.kind == "op":
+                if t.text in "([{":
+                    stack.append(t.text)
+                elif t.text in ")]}" and stack:
+                    stack.pop()
+            elif t.kind == "kw":
+                if t.text in OPENERS:
+                    stack.append(t.text)
+                elif t.text in CLOSERS and stack:
+                    stack.pop()
+        return result
+
+    def is_assigned(self, j, braces):
+        """True when the expression ending at j is an assignment target."""
+        nxt = self.text(j + 1)
+        if braces[j]:
+            return False  # table constructor key or item
+        if nxt == "=":
+            return True
+        if nxt != ",":
+            return False
+        depth = 0
+        for k in range(j + 1, len(self)):
+            t = self.tok(k)
+            if t.kind == "kw" or t.kind == "eof":
+                return False
+            if t.kind != "op":
+                continue
+            if t.text in "([{":
+                depth += 1
+            elif t.text in ")]}":
+                if depth == 0:
+                    return False
+                depth -= 1
+            elif t.text == "=" and depth == 0:
+                return True
+        return False
+
+    def declarations(self):
+        """Indices of names bound by local, for, function parameters."""
+        decls = []
+        n = len(self)
+        for j in range(n):
+            t = self.tok(j)
+            if t.kind != "kw":
+                continue
+            if t.text == "local" or t.text == "for":
+                k = j + 1
+                if self.text(k) == "function":
+                    decls.append(k + 1)
+                    continue
+                while self.is_name(k):
+                    decls.append(k)
+                    k += 1
+                    if self.text(k) == "<":
+                        k += 3
+                    if self.text(k) != ",":
+                        break
+                    k += 1
+            elif t.text == "function":
+                k = j + 1
+                while self.text(k) != "(" and k < n:
+                    k += 1
+                k += 1
+                while self.is_name(k):
+                    decls.append(k)
+                    k += 1
+                    if self.text(k) == ",":
+                        k += 1
+        return decls
+
+    def nesting(self):
+        """Per token: (inside a loop or function body?, at chunk level?)."""
+        hot = []
+        top = []
+        stack = []
+        pending_loop = False
+        for j in range(len(self)):
+            t = self.tok(j)
+            if t.kind == "kw":
+                if t.text in ("while", "for"):
+                    pending_loop = True
+                elif t.text == "do":
+                    stack.append(pending_loop)
+                    pending_loop = False
+                elif t.text in ("function", "repeat"):
+                    stack.append(True)
+                elif t.text == "if":
+                    stack.append(False)
+                elif t.text in CLOSERS and stack:
+                    stack.pop()
+            hot.append(any(stack))
+            top.append(not stack)
+        return hot, top
+
+    def require_end(self, j):
+        """Last index of `local NAME = require ...` at j, or None."""
+        if not (self.text(j) == "local" and self.is_name(j + 1)
+                and self.text(j + 2) == "=" and self.text(j + 3) == "require"):
+            return None
+        if self.text(j + 4) == "(":
+            end = self.match_bracket(j + 4)
+        elif self.tok(j + 4).kind == "string":
+            end = j + 4
+        else:
+            return None
+        if end is None or self.text(end + 1) in (".", ":", "[", "("):
+            return None
+        return end
+
+    def rewrite(self, edits):
+        """Apply {sig_index_range: [Tok]} edits; return a new token list."""
+        out = []
+        i = 0
+        for (start, stop), repl in sorted(edits.items()):
+            a = self.sig[start]
+            b = self.sig[stop - 1] + 1
+            out.extend(self.toks[i:a])
+            out.extend(repl)
+            i = b
+        out.extend(self.toks[i:])
+        return out
+
+    def span_text(self, start, stop):
+        return untokenize(self.toks[self.sig[start]:self.sig[stop - 1] + 1])
+
+
+# ---------------------------------------------------------------------------
+# Constant expressions
+# ---------------------------------------------------------------------------
+
+_NOCONST = object()
+
+
+class _Eval:
+    """Evaluate a condition made only of literals; _NOCONST otherwise."""
+
+    def __init__(self, toks):
+        self.toks = toks
+        self.pos = 0
+
+    def peek(self):
+        return self.toks[self.pos].text if self.pos < len(self.toks) else None
+
+    def run(self):
+        try:
+            v = self.expr_or()
+        except (ValueError, TypeError, IndexError, ZeroDivisionError):
+            return _NOCONST
+        return v if self.pos == len(self.toks) else _NOCONST
+
+    def expr_or(self):
+        v = self.expr_and()
+        while self.peek() == "or":
+            self.pos += 1
+            w = self.expr_and()
+            v = v if _truthy(v) else w
+        return v
+
+    def expr_and(self):
+        v = self.expr_cmp()
+        while self.peek() == "and":
+            self.pos += 1
+            w = self.expr_cmp()
+            v = w if _truthy(v) else v
+        return v
+
+    def expr_cmp(self):
+        v = self.expr_unary()
+        while self.peek() in ("==", "~=", "<", "<=", ">", ">="):
+            op = self.peek()
+            self.pos += 1
+            w = self.expr_unary()
+            if op in ("==", "~="):
+                eq = type(v) is type(w) and v == w or (
+                    _isnum(v) and _isnum(w) and v == w)
+                v = eq if op == "==" else not eq
+            else:
+                if not (_isnum(v) and _isnum(w)) and not (
+                        isinstance(v, str) and isinstance(w, str)):
+                    raise TypeError
+                v = {"<": v < w, "<=": v <= w, ">": v > w, ">=": v >= w}[op]
+        return v
+
+    def expr_unary(self):
+        t = self.peek()
+        if t == "not":
+            self.pos += 1
+            return not _truthy(self.expr_unary())
+        if t == "-":
+            self.pos += 1
+            v = self.expr_unary()
+            if not _isnum(v):
+                raise TypeError
+            return -v
+        return self.atom()
+
+    def atom(self):
+        tok = self.toks[self.pos]
+        self.pos += 1
+        if tok.text == "(":
+            v = self.expr_or()
+            if self.peek() != ")":
+                raise ValueError
+            self.pos += 1
+            return v
+        if tok.text == "true":
+            return True
+        if tok.text == "false":
+            return False
+        if tok.text == "nil":
+            return None
+        if tok.kind == "number":
+            return _number(tok.text)
+        if tok.kind == "string" and tok.text[0] in "'\"" and "\\" not in tok.text:
+            return tok.text[1:-1]
+        raise ValueError
+
+
+def _truthy(v):
+    return v is not None and v is not False
+
+
+def _isnum(v):
+    return isinstance(v, (int, float)) and not isinstance(v, bool)
+
+
+def _number(text):
+    if text.lower().startswith("0x"):
+        if "." in text or "p" in text.lower():
+            return float.fromhex(text)
+        return int(text, 16)
+    if any(c in text for c in ".eE"):
+        return float(text)
+    return int(text)
+
+
+def const_value(script, start, stop):
+    return _Eval([script.tok(j) for j in range(start, stop)]).run()
+
+
+def _is_literal(script, j):
+    """End index (exclusive) of a literal starting at j, or None."""
+    t = script.tok(j)
+    if t.kind == "op" and t.text == "-" and script.tok(j + 1).kind == "number":
+        j += 1
+        t = script.tok(j)
+    if t.kind in ("number", "string") or t.text in ("true", "false", "nil"):
+        return j + 1
+    return None
+
+
+# ---------------------------------------------------------------------------
+# Passes
+# ---------------------------------------------------------------------------
+
+
+def apply_defines(toks, defines, stats):
+    """Replace reads of the defined global names with their values."""
+    s = Script(toks)
+    braces = s.in_braces()
+    declared = {s.text(j) for j in s.declarations()}
+    edits = {}
+    for name, value in defines.items():
+        refs = [j for j in range(len(s)) if s.is_name(j, name) and s.is_ref(j)]
+        if name in declared or any(s.is_assigned(j, braces) for j in refs):
+            print(f"luaz_opt: not substituting {name}: declared or assigned")
+            continue
+        for j in refs:
+            if braces[j] and s.text(j + 1) == "=":
+                continue  # table constructor key
+            edits[(j, j + 1)] = tokenize(f"({value})")
+            stats["defines"] += 1
+    return s.rewrite(edits)
+
+
+def remove_dead_branches(toks, stats):
+    """Resolve if statements with constant conditions; one at a time."""
+    s = Script(toks)
+    for j in range(len(s)):
+        if s.text(j) != "if" or s.tok(j).kind != "kw":
+            continue
+        end = s.match_block(j)
+        if end is None:
+            return toks, False
+
+        # Clauses as (kw_index, cond_start, cond_stop, body_start).
+        clauses = []
+        depth = 0
+        k = j
+        while k < end:
+            t = s.tok(k)
+            if t.kind == "kw":
+                if depth == 1 and t.text in ("elseif", "else") or k == j:
+                    if t.text == "else":
+                        clauses.append((k, None, None, k + 1))
+                    else:
+                        then = k + 1
+                        while not (s.text(then) == "then" and s.tok(then).kind == "kw"):
+                            then += 1
+                        clauses.append((k, k + 1, then, then + 1))
+                if t.text in OPENERS:
+                    depth += 1
+                elif t.text in CLOSERS:
+                    depth -= 1
+            k += 1
+
+        values = [True if c[1] is None else const_value(s, c[1], c[2])
+                  for c in clauses]
+        if all(v is _NOCONST for c, v in zip(clauses, values) if c[1] is not None):
+            continue
+
+        kept = []
+        for idx, (clause, v) in enumerate(zip(clauses, values)):
+            stop = clauses[idx + 1][0] if idx + 1 < len(clauses) else end
+            if v is not _NOCONST and not _truthy(v):
+                continue
+            kept.append((clause, stop, v))
+            if v is not _NOCONST:
+                break  # unconditional from here on
+
+        pieces = []
+        for idx, ((kw, cs, ce, body), stop, v) in enumerate(kept):
+            if v is not _NOCONST:
+                lead = "do" if idx == 0 else "else"
+                pieces.append(Tok("kw", lead))
+            else:
+                pieces.append(Tok("kw", "if" if idx == 0 else "elseif"))
+                pieces.append(Tok("ws", " "))
+                pieces.extend(tokenize(s.span_text(cs, ce + 1)))
+            pieces.extend(s.toks[s.sig[body - 1] + 1:s.sig[stop]])
+            # Dropped clauses between this one and the next kept one.
+        if kept:
+            pieces.append(Tok("kw", "end"))
+        text = s.span_text(j, end + 1)
+        kept_lines = untokenize(pieces).count("\n")
+        pieces.append(_blank("\n" * (text.count("\n") - kept_lines)))
+        stats["dead_branches"] += 1
+        return s.rewrite({(j, end + 1): pieces}), True
+    return toks, False
+
+
+def remove_unused_functions(toks, stats):
+    """Drop one `local function` that nothing references."""
+    s = Script(toks)
+    for j in range(len(s)):
+        if not (s.text(j) == "local" and s.text(j + 1) == "function"
+                and s.is_name(j + 2)):
+            continue
+        name = s.text(j + 2)
+        end = s.match_block(j + 1)
+        if end is None:
+            return toks, False
+        used = any(s.is_name(k, name) and s.is_ref(k)
+                   for k in range(len(s)) if k < j or k > end)
+        if used:
+            continue
+        stats["unused_functions"] += 1
+        return s.rewrite({(j, end + 1): [_blank(s.span_text(j, end + 1))]}), True
+    return toks, False
+
+
+def mark_const_locals(toks, stats):
+    """Add <const> to literal locals that are never reassigned."""
+    s = Script(toks)
+    braces = s.in_braces()
+    decls = s.declarations()
+    counts = {}
+    for j in decls:
+        counts[s.text(j)] = counts.get(s.text(j), 0) + 1
+    edits = {}
+    for j in range(len(s)):
+        if not (s.text(j) == "local" and s.is_name(j + 1)
+                and s.text(j + 2) == "=" and s.tok(j + 2).kind == "op"):
+            continue
+        name = s.text(j + 1)
+        lit_end = _is_literal(s, j + 3)
+        if lit_end is None or counts.get(name) != 1:
+            continue
+        nxt = s.tok(lit_end)
+        if not (nxt.kind in ("name", "eof") or nxt.text == ";" or (
+                nxt.kind == "kw" and nxt.text not in ("and", "or"))):
+            continue
+        if any(s.is_name(k, name) and s.is_ref(k) and s.is_assigned(k, braces)
+               for k in range(len(s)) if k != j + 1):
+            continue
+        edits[(j + 1, j + 2)] = [Tok("name", name), Tok("ws", " "),
+                                 *tokenize("<const>")]
+        stats["const_locals"] += 1
+    return s.rewrite(edits)
+
+
+def hoist_lookups(toks, stats):
+    """Resolve field chains of require()d module locals once, at the require."""
+    s = Script(toks)
+    braces = s.in_braces()
+    decls = s.declarations()
+    counts = {}
+    for j in decls:
+        counts[s.text(j)] = counts.get(s.text(j), 0) + 1
+    names = {s.text(j) for j in range(len(s)) if s.is_name(j)}
+
+    hot, top = s.nesting()
+
+    edits = {}
+    hoisted = 0
+    for j in range(len(s)):
+        stmt_end = s.require_end(j) if top[j] else None
+        if stmt_end is None:
+            continue
+        root = s.text(j + 1)
+        if counts.get(root) != 1:
+            continue
+
+        # Maximal field chains read through the root; give up on the root
+        # if it is ever reassigned, indexed or written through.
+        chains = {}
+        safe = True
+        for k in range(stmt_end + 1, len(s)):
+            if not (s.is_name(k, root) and s.is_ref(k)):
+                continue
+            if s.is_assigned(k, braces):
+                safe = False
+                break
+            e = k
+            while s.text(e + 1) == "." and s.is_name(e + 2):
+                e += 2
+            if s.text(e + 1) == "[" or (e > k and s.is_assigned(e, braces)):
+                safe = False
+                break
+            if e > k:
+                chains.setdefault(tuple(s.text(x) for x in range(k, e + 1, 2)),
+                                  []).append((k, e, hot[k]))
+        if not safe:
+            continue
+
+        decl = []
+        for chain, uses in sorted(chains.items()):
+            if not any(h for _, _, h in uses) or hoisted >= MAX_HOISTS:
+                continue
+            local = "__" + "_".join(chain)
+            if local in names:
+                continue
+            names.add(local)
+            guard = " and ".join(".".join(chain[:n]) for n in range(2, len(chain) + 1))
+            decl.extend(tokenize(f" local {local} = {guard}"))
+            for k, e, _ in uses:
+                edits[(k, e + 1)] = [Tok("name", local)]
+            hoisted += 1
+            stats["hoisted"] += 1
+        if decl:
+            last = s.tok(stmt_end)
+            edits[(stmt_end, stmt_end + 1)] = [Tok(last.kind, last.text), *decl]
+    return s.rewrite(edits)
+
+
+def split_lazy(toks, chunk, stats):
+    """Move large chunk-level functions into modules loaded on first call.
+
+    Returns the new token list and {module name: module source}.
+    """
+    s = Script(toks)
+    braces = s.in_braces()
+    decls = s.declarations()
+    _, top = s.nesting()
+    counts = {}
+    for j in decls:
+        counts[s.text(j)] = counts.get(s.text(j), 0) + 1
+
+    # Chunk-level locals a split function may take along: module locals and
+    # literal constants, as (declaration start, declaration end).
+    portable = {}
+    for j in range(len(s)):
+        if not top[j] or s.text(j) != "local" or not s.is_name(j + 1):
+            continue
+        name = s.text(j + 1)
+        end = s.require_end(j)
+        if end is None and [s.text(j + k) for k in range(2, 6)] == ["<", "const", ">", "="]:
+            lit_end = _is_literal(s, j + 6)
+            end = None if lit_end is None else lit_end - 1
+        if end is None or counts.get(name) != 1:
+            continue
+        if any(s.is_name(k, name) and s.is_ref(k) and s.is_assigned(k, braces)
+               for k in range(len(s)) if k != j + 1):
+            continue
+        portable[name] = (j, end + 1)
+
+    edits = {}
+    modules = {}
+    for j in range(len(s)):
+        if not top[j]:
+            continue
+        if s.text(j) == "local" and s.text(j + 1) == "function":
+            fn, is_local = j + 1, True
+        elif s.text(j) == "function" and s.text(j - 1) != "local":
+            fn, is_local = j, False
+        else:
+            continue
+        if not (s.is_name(fn + 1) and s.text(fn + 2) == "("):
+            continue
+        name = s.text(fn + 1)
+        end = s.match_block(fn)
+        if end is None or end - fn < LAZY_MIN_TOKENS:
+            continue
+
+        # Chunk-level locals in scope at the definition.
+        outside = set()
+        for k in range(j):
+            if top[k] and s.text(k) == "local":
+                k += 2 if s.text(k + 1) == "function" else 1
+                while s.is_name(k):
+                    outside.add(s.text(k))
+                    k += 4 if s.text(k + 1) == "<" else 1
+                    if s.text(k) != ",":
+                        break
+                    k += 1
+        if not is_local and name in outside:
+            continue
+        needed = []
+        for k in range(fn + 2, end):
+            if not (s.is_name(k) and s.is_ref(k)):
+                continue
+            ref = s.text(k)
+            if ref == name or ref not in outside or ref in needed:
+                continue
+            if ref not in portable or portable[ref][0] >= j:
+                break
+            needed.append(ref)
+        else:
+            module = f"{chunk}:{name}"
+            lines = [s.span_text(*portable[n]) for n in sorted(needed, key=lambda n: portable[n])]
+            lines.append(f"local function {name}" + s.span_text(fn + 2, end + 1))
+            lines.append(f"return {name}\n")
+            modules[module] = "\n".join(lines)
+
+            stub = (f"{'local ' if is_local else ''}function {name}(...) "
+                    f"{name} = require(\"{module}\") return {name}(...) end")
+            text = s.span_text(j, end + 1)
+            edits[(j, end + 1)] = [*tokenize(stub), _blank(text)]
+            stats["lazy_functions"] += 1
+    return s.rewrite(edits), modules
+
+
+def optimize(src, defines=None, lazy=None):
+    """Return (optimized source, stats dict, {lazy module: source}).
+
+    With @p lazy set to the chunk name, large chunk-level functions are
+    split into modules named "<chunk>:<function>" (see split_lazy()).
+    """
+    stats = {"defines": 0, "dead_branches": 0, "unused_functions": 0,
+             "const_locals": 0, "hoisted": 0, "lazy_functions": 0}
+    toks = tokenize(src)
+    if defines:
+        toks = apply_defines(toks, defines, stats)
+    changed = True
+    while changed:
+        toks, changed = remove_dead_branches(toks, stats)
+        if not changed:
+            toks, changed = remove_unused_functions(toks, stats)
+    toks = mark_const_locals(toks, stats)
+    modules = {}
+    if lazy:
+        toks, modules = split_lazy(toks, lazy, stats)
+        for module, text in modules.items():
+            mod_toks = hoist_lookups(tokenize(text), stats)
+            modules[module] = untokenize(mod_toks)
+    toks = hoist_lookups(toks, stats)
+    return untokenize(toks), stats, modules
@@ -5,17 +5,55 @@
 local zbus_channel = {}
 
 --- Publish a message table to this channel.
----@param data table # Message table matching the channel descriptor.
+---@param data table|zbus_view # Message table or view of a channel with the same message type.
 ---@param timeout_ms integer # Timeout in milliseconds.
 ---@return integer err # 0 on success, negative errno on failure.
 function zbus_channel:pub(data, timeout_ms) end
 
+--- Publish a sequence of messages in order, validating arguments once.
+--- An element that is neither a table nor a view of this message type
+--- raises an error before anything is published. Stops at the first failed
+--- conversion (out of memory) or publish, and reports it in `err`.
+---@param list (table|zbus_view)[] # Message tables and/or views.
+---@param timeout_ms integer # Timeout in milliseconds, per message.
+---@return integer count # Number of messages published.
+---@return integer err # 0 if all were published, else the error that stopped the batch.
+function zbus_channel:pub_many(list, timeout_ms) end
+
 --- Read the current message from this channel.
 ---@param timeout_ms integer # Timeout in milliseconds.
 ---@return integer err # 0 on success, negative errno on failure.
 ---@return table|nil data # Message table, or nil on error.
 function zbus_channel:read(timeout_ms) end
 
+--- Read the current message into an existing table (no allocation).
+--- Nested subtables already present in the table are reused.
+---@param data table # Table to refill; left untouched on error.
+---@param timeout_ms integer # Timeout in milliseconds.
+---@return integer err # 0 on success, negative errno on failure.
+---@return table data # The same table.
+function zbus_channel:read_into(data, timeout_ms) end
+
+--- Read the current message into a view without decoding it.
+--- Fields are decoded on access (view.field) and encoded on assignment.
+---@param timeout_ms integer # Timeout in milliseconds.
+---@param view? zbus_view # View of this channel to refill (no allocation).
+---@return integer err # 0 on success, negative errno on failure.
+---@return zbus_view|nil view # The view, or nil if the channel has no descriptor.
+function zbus_channel:view(timeout_ms, view) end
+
+--- Claim the channel and call fn with a view on the channel's own message.
+--- The claim is released when fn returns or raises (the error is re-raised);
+--- observers are notified if fn assigned any field.  fn must not block.
+---@param timeout_ms integer # Claim (and notify) timeout in milliseconds.
+---@param fn fun(view: zbus_view): ... # Runs while the channel is claimed.
+---@return integer err # 0 on success, negative errno on failure.
+---@return any ... # Values returned by fn.
+function zbus_channel:with_claim(timeout_ms, fn) end
+
+--- Raw zbus message with lazy, per-field access.
+---@class zbus_view
+
 --- zbus observer userdata (returned by zbus.observer_declare).
 ---@class zbus_observer
 local zbus_observer = {}
@@ -27,6 +65,26 @@ local zbus_observer = {}
 ---@return table|nil data # Message table, or nil on error.
 function zbus_observer:wait_msg(timeout_ms) end
 
+--- Wait for a message and decode it into an existing table (no allocation).
+--- Nested subtables already present in the table are reused.
+---@param data table # Table to refill; left untouched on error.
+---@param timeout_ms integer # Timeout in milliseconds.
+---@return integer err # 0 on success, negative errno on failure.
+---@return zbus_channel|nil channel # Source channel, or nil on error.
+---@return table data # The same table.
+function zbus_observer:wait_msg_into(data, timeout_ms) end
+
+--- Wait for one message, then take every message already queued, up to max_n.
+--- Entry i of the batch is { chan = zbus_channel, msg = table }.  Passing the
+--- previous batch reuses its tables; entries past n are stale and must be ignored.
+---@param max_n integer # Maximum number of messages to take.
+---@param first_timeout_ms integer # Timeout for the first message only.
+---@param batch? table # Batch to refill.
+---@return integer err # 0 if at least one message was drained, else the wait error.
+---@return integer n # Number of valid entries in batch.
+---@return table batch # The (new or refilled) batch.
+function zbus_observer:drain(max_n, first_timeout_ms, batch) end
+
 --- zbus pub/sub namespace (requires CONFIG_LUA_LIB_ZBUS).
 ---@class zbus
 local zbus = {}
@@ -43,6 +101,14 @@ function zbus.channel_declare(name) end
 ---@return zbus_observer observer # Observer userdata.
 function zbus.observer_declare(name) end
 
+--- Call fn(channel, msg) from zephyr.run() whenever the channel is published.
+--- Notifications coalesce: msg is read at dispatch time and holds the latest
+--- message (the same table on every call).  Requires CONFIG_LUA_ZBUS_LISTEN.
+---@param channel zbus_channel # Channel to listen on.
+---@param fn fun(channel: zbus_channel, msg: table|nil) # Callback.
+---@return integer err # 0 on success, -ENOMEM when no listen slot is free.
+function zbus.listen(channel, fn) end
+
 --- Filesystem API (requires CONFIG_LUA_FS).
 ---@class fs
 local fs = {}
@@ -74,6 +140,56 @@ local zephyr = {}
 ---@param ms integer # Duration in milliseconds.
 function zephyr.msleep(ms) end
 
+--- Milliseconds elapsed since boot.
+---@return integer ms
+function zephyr.uptime_ms() end
+
+--- Run incremental GC steps for at most `us` microseconds.
+--- Call it in idle time (e.g. between zbus waits) to keep collector
+--- pauses out of the control loop.
+---@param us integer # Time budget in microseconds, > 0.
+---@return boolean done # A collection cycle completed.
+---@return integer steps # GC steps run.
+function zephyr.gc_step_budget(us) end
+
+--- GC work that blocking calls (msleep, zbus waits, run) moved into idle time.
+--- Requires CONFIG_LUA_IDLE_GC.
+---@return integer steps # GC steps run before blocking.
+---@return integer cycles # GC cycles completed that way.
+---@return integer us # Time spent, in microseconds.
+function zephyr.idle_gc_stats() end
+
+---@class zephyr_mem_stats
+---@field allocs integer # New blocks.
+---@field frees integer # Freed blocks.
+---@field reallocs integer # Resized blocks.
+---@field failures integer # Requests that could not be served.
+---@field in_use integer # Bytes currently allocated by Lua.
+---@field peak integer # High-water mark of in_use.
+---@field size integer # Heap size in bytes.
+---@field hist integer[] # hist[i]: requests of 2^(i-1) to 2^i - 1 bytes.
+---@field types table<string, integer> # Bytes allocated per type (string, table, function, userdata, thread, other).
+
+--- Allocation statistics of this Lua state's heap.
+--- Requires CONFIG_LUA_ALLOC_STATS.
+---@return zephyr_mem_stats
+function zephyr.mem_stats() end
+
+--- Get or set the memory limit of this Lua state's heap.
+--- Allocations beyond the limit trigger an emergency GC, then a memory error.
+--- Requires CONFIG_LUA_MEM_LIMIT.
+---@param bytes? integer # New limit (0 = heap size); unchanged if omitted.
+---@return integer limit # Limit in bytes.
+---@return integer in_use # Bytes currently held by Lua.
+---@return boolean pressure # Usage is above the pressure mark (GC driven harder).
+function zephyr.mem_limit(bytes) end
+
+--- Run the zbus.listen() event loop of this Lua state.
+--- Requires CONFIG_LUA_ZBUS_LISTEN.
+---@param timeout_ms? integer # Run time in ms (forever if omitted, 0 = only pending).
+---@return integer dispatched # Number of callbacks run.
+function zephyr.run(timeout_ms) end
+
 --- Print a message via Zephyr printk.
 ---@param message string # Message to print.
 function zephyr.printk(message) end
@@ -0,0 +1,117 @@
+/**
+ * @file luaz_bundle.c
+ * @brief Bytecode module archives searched by require().
+ *
+ * The archives are walked in place in flash: the index is binary-searched
+ * by name and the chunk is handed to luaz_load_bytecode(), so a bundle
+ * costs no RAM until one of its modules is required.
+ */
+
+#include "luaz_bundle.h"
+
+#include <string.h>
+#include <luaz_bytecode.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_DECLARE(lua_zephyr, CONFIG_LUA_ZEPHYR_LOG_LEVEL);
+
+/** @brief Magic and module count. */
+#define BUNDLE_HDR_SIZE   8
+/** @brief Name offset, chunk offset and chunk length. */
+#define BUNDLE_ENTRY_SIZE 12
+
+static const uint8_t bundle_magic[4] = {'L', 'Z', 'B', 0x01};
+
+/**
+ * @brief Number of modules in @p b, or 0 if it is not a valid archive.
+ *
+ * Silent: called on every lookup, bad archives are reported once by
+ * luaz_bundle_init().
+ */
+static uint32_t bundle_count(const struct luaz_bundle *b)
+{
+	if (b->len < BUNDLE_HDR_SIZE || memcmp(b->data, bundle_magic, sizeof(bundle_magic)) != 0) {
+		return 0;
+	}
+
+	uint32_t count = sys_get_le32(&b->data[sizeof(bundle_magic)]);
+
+	if (count > (b->len - BUNDLE_HDR_SIZE) / BUNDLE_ENTRY_SIZE) {
+		return 0;
+	}
+
+	return count;
+}
+
+/** @brief Binary-search @p b for @p name; return its index entry or NULL. */
+static const uint8_t *bundle_find(const struct luaz_bundle *b, const char *name)
+{
+	const uint8_t *index = &b->data[BUNDLE_HDR_SIZE];
+	uint32_t lo = 0;
+	uint32_t hi = bundle_count(b);
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const uint8_t *entry = &index[mid * BUNDLE_ENTRY_SIZE];
+		uint32_t name_off = sys_get_le32(entry);
+
+		if (name_off >= b->len) {
+			return NULL;
+		}
+
+		int cmp = strncmp(name, (const char *)&b->data[name_off], b->len - name_off);
+
+		if (cmp == 0) {
+			return entry;
+		}
+		if (cmp < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	return NULL;
+}
+
+int luaz_bundle_load(lua_State *L, const char *name)
+{
+	STRUCT_SECTION_FOREACH(luaz_bundle, b) {
+		const uint8_t *entry = bundle_find(b, name);
+
+		if (entry == NULL) {
+			continue;
+		}
+
+		uint32_t off = sys_get_le32(&entry[4]);
+		uint32_t len = sys_get_le32(&entry[8]);
+
+		if (off > b->len || len > b->len - off) {
+			lua_pushfstring(L, "module '%s': chunk outside its bundle", name);
+			return LUA_ERRSYNTAX;
+		}
+
+		return luaz_load_bytecode(L, &b->data[off], len, name);
+	}
+
+	return -ENOENT;
+}
+
+/** @brief Report malformed bundles once at boot; lookups then skip them. */
+static int luaz_bundle_init(void)
+{
+	STRUCT_SECTION_FOREACH(luaz_bundle, b) {
+		if (b->len < BUNDLE_HDR_SIZE ||
+		    memcmp(b->data, bundle_magic, sizeof(bundle_magic)) != 0) {
+			LOG_WRN("bundle %p: bad header", (const void *)b->data);
+		} else if (bundle_count(b) == 0 && sys_get_le32(&b->data[sizeof(bundle_magic)]) != 0) {
+			LOG_WRN("bundle %p: truncated index", (const void *)b->data);
+		}
+	}
+
+	return 0;
+}
+
+SYS_INIT(luaz_bundle_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,180 @@
+/**
+ * @file luaz_bytecode.c
+ * @brief Loading of pre-compiled bytecode embedded in flash.
+ *
+ * With CONFIG_LUA_BYTECODE_COMPRESS, blobs generated with
+ * `luaz_gen.py --compress` are LZSS streams:
+ *
+ *   "\x1bLZ\x01", uncompressed size (u32 LE), then groups of one flag byte
+ *   (LSB first, 1 = literal) and up to eight items: a literal byte, or a
+ *   u16 LE match of (length - LZ_MIN_MATCH) << 10 | (distance - 1).
+ *
+ * They are decoded by a lua_load() reader into a LZ_WINDOW-byte ring
+ * buffer, borrowed from the state's allocator for the duration of the load.
+ * Each call hands the newly decoded stretch of the ring to lua_load(), so
+ * the uncompressed chunk never sits in RAM as a whole.
+ */
+
+#include "luaz_bytecode.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <lauxlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+LOG_MODULE_DECLARE(lua_zephyr, CONFIG_LUA_ZEPHYR_LOG_LEVEL);
+
+#ifdef CONFIG_LUA_BYTECODE_COMPRESS
+
+/** @brief Ring buffer size; matches reach at most this far back. */
+#define LZ_WINDOW    1024
+/** @brief Shortest match; shorter repeats are stored as literals. */
+#define LZ_MIN_MATCH 3
+/** @brief Magic and uncompressed size. */
+#define LZ_HDR_SIZE  8
+
+BUILD_ASSERT(IS_POWER_OF_TWO(LZ_WINDOW));
+
+static const uint8_t lz_magic[4] = {0x1b, 'L', 'Z', 0x01};
+
+/** @brief lua_load() reader state for a compressed blob. */
+struct lz_reader {
+	const uint8_t *in;
+	size_t in_len;
+	size_t in_pos;
+	/** Bytes decoded so far; the ring position is pos % LZ_WINDOW. */
+	size_t pos;
+	/** Pending match, continued by the next reader call. */
+	uint16_t match_dist;
+	uint8_t match_len;
+	/** Flag byte of the current group and the items left in it. */
+	uint8_t flags;
+	uint8_t flag_bits;
+	uint8_t window[LZ_WINDOW];
+};
+
+/** @brief lua_Reader: decode up to the end of the ring and return that stretch. */
+static const char *lz_read(lua_State *L, void *ud, size_t *size)
+{
+	struct lz_reader *r = ud;
+	size_t start = r->pos % LZ_WINDOW;
+	size_t room = LZ_WINDOW - start;
+	size_t n = 0;
+
+	ARG_UNUSED(L);
+
+	while (n < room) {
+		if (r->match_len > 0) {
+			r->window[start + n] = r->window[(r->pos - r->match_dist) % LZ_WINDOW];
+			r->match_len--;
+			r->pos++;
+			n++;
+			continue;
+		}
+
+		if (r->flag_bits == 0) {
+			if (r->in_pos >= r->in_len) {
+				break;
+			}
+			r->flags = r->in[r->in_pos++];
+			r->flag_bits = 8;
+		}
+
+		if (r->in_pos >= r->in_len) {
+			break;
+		}
+
+		bool literal = r->flags & 1;
+
+		r->flags >>= 1;
+		r->flag_bits--;
+
+		if (literal) {
+			r->window[start + n] = r->in[r->in_pos++];
+			r->pos++;
+			n++;
+		} else {
+			if (r->in_len - r->in_pos < 2) {
+				break;
+			}
+
+			uint16_t token = sys_get_le16(&r->in[r->in_pos]);
+
+			r->in_pos += 2;
+			r->match_dist = (token & (LZ_WINDOW - 1)) + 1;
+			r->match_len = (token >> 10) + LZ_MIN_MATCH;
+		}
+	}
+
+	*size = n;
+
+	return n > 0 ? (const char *)&r->window[start] : NULL;
+}
+
+/** @brief Load a compressed blob through lz_read(). */
+static int load_lz(lua_State *L, const uint8_t *buf, size_t len, const char *name)
+{
+	void *ud;
+	lua_Alloc allocf = lua_getallocf(L, &ud);
+	struct lz_reader *r = allocf(ud, NULL, LUA_TNIL, sizeof(*r));
+
+	if (r == NULL) {
+		lua_pushliteral(L, "not enough memory");
+		return LUA_ERRMEM;
+	}
+
+	r->in = buf + LZ_HDR_SIZE;
+	r->in_len = len - LZ_HDR_SIZE;
+	r->in_pos = 0;
+	r->pos = 0;
+	r->match_len = 0;
+	r->flag_bits = 0;
+
+	int rc = lua_load(L, lz_read, r, name, "b");
+
+	if (rc == LUA_OK && r->pos != sys_get_le32(&buf[sizeof(lz_magic)])) {
+		lua_pop(L, 1);
+		lua_pushfstring(L, "%s: truncated compressed bytecode", name);
+		rc = LUA_ERRSYNTAX;
+	}
+
+	allocf(ud, r, sizeof(*r), 0);
+
+	return rc;
+}
+
+#endif /* CONFIG_LUA_BYTECODE_COMPRESS */
+
+int luaz_load_bytecode(lua_State *L, const void *buf, size_t len, const char *name)
+{
+	const char *mode = "b";
+	uint32_t start = k_cycle_get_32();
+	int rc;
+
+#ifdef CONFIG_LUA_BYTECODE_COMPRESS
+	if (len >= LZ_HDR_SIZE && memcmp(buf, lz_magic, sizeof(lz_magic)) == 0) {
+		rc = load_lz(L, buf, len, name);
+		LOG_DBG("%s: loaded %zu bytes (%u unpacked) in %u us", name, len,
+			sys_get_le32((const uint8_t *)buf + sizeof(lz_magic)),
+			k_cyc_to_us_floor32(k_cycle_get_32() - start));
+		return rc;
+	}
+#endif
+
+	if (IS_ENABLED(CONFIG_LUA_BYTECODE_IN_PLACE)) {
+		if (((uintptr_t)buf % LUAZ_BYTECODE_ALIGN) == 0) {
+			mode = "B";
+		} else {
+			LOG_WRN("%s: unaligned bytecode, loading by copy", name);
+		}
+	}
+
+	rc = luaL_loadbufferx(L, buf, len, name, mode);
+	LOG_DBG("%s: loaded %zu bytes in %u us", name, len,
+		k_cyc_to_us_floor32(k_cycle_get_32() - start));
+
+	return rc;
+}
@@ -18,6 +18,7 @@
 #include <lauxlib.h>
 #include <lualib.h>
 #include <luaz_fs.h>
+#include <luaz_rom.h>
 #include <luaz_utils.h>
 #include <zephyr/kernel.h>
 #include <zephyr/fs/fs.h>
@@ -317,7 +318,7 @@ static const luaL_Reg fs_lib[] = {
 
 int luaopen_fs(lua_State *L)
 {
-	luaL_newlib(L, fs_lib);
+	luaz_rom_newlib(L, fs_lib);
 
 	/* Replace global dofile and loadfile with FS-backed versions */
 	lua_pushcfunction(L, l_fs_dofile);
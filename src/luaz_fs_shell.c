@@ -15,6 +15,7 @@
 #include <lauxlib.h>
 #include <luaz_utils.h>
 #include <luaz_fs.h>
+#include <luaz_state_pool.h>
 #include <zephyr/kernel.h>
 #include <zephyr/shell/shell.h>
 #include <zephyr/fs/fs.h>
@@ -272,7 +273,12 @@ static int cmd_delete(const struct shell *sh, size_t argc, char **argv)
 	return 0;
 }
 
-/** @brief Shell command: lua_fs run <name> — execute a script in a temporary Lua state. */
+/**
+ * @brief Shell command: lua_fs run <name> — execute a script in a temporary Lua state.
+ *
+ * With CONFIG_LUA_STATE_POOL the state comes from the pool and is reset
+ * afterwards instead of being created and closed.
+ */
 static int cmd_run(const struct shell *sh, size_t argc, char **argv)
 {
 	if (argc < 2) {
@@ -280,10 +286,18 @@ static int cmd_run(const struct shell *sh, size_t argc, char **argv)
 		return -EINVAL;
 	}
 
+#ifdef CONFIG_LUA_STATE_POOL
+	lua_State *L = luaz_state_acquire(K_NO_WAIT);
+
+	if (L == NULL) {
+		shell_error(sh, "No free Lua state in the pool");
+		return -EBUSY;
+	}
+#else
 	static char heap_buf[CONFIG_LUA_THREAD_HEAP_SIZE];
-	static struct sys_heap run_heap;
+	static struct luaz_heap run_heap;
 
-	sys_heap_init(&run_heap, heap_buf, CONFIG_LUA_THREAD_HEAP_SIZE);
+	luaz_heap_init(&run_heap, "lua_fs_run", heap_buf, CONFIG_LUA_THREAD_HEAP_SIZE);
 
 	lua_State *L = lua_newstate(lua_zephyr_allocator, &run_heap, 0);
 
@@ -293,6 +307,9 @@ static int cmd_run(const struct shell *sh, size_t argc, char **argv)
 	}
 
 	luaz_openlibs(L);
+	luaz_gc_configure(L, IS_ENABLED(CONFIG_LUA_GC_GENERATIONAL), CONFIG_LUA_GC_PAUSE,
+			  CONFIG_LUA_GC_STEPMUL, CONFIG_LUA_GC_STEPSIZE);
+#endif
 
 	int rc = lua_fs_dofile(L, argv[1]);
 
@@ -304,7 +321,11 @@ static int cmd_run(const struct shell *sh, size_t argc, char **argv)
 		}
 	}
 
+#ifdef CONFIG_LUA_STATE_POOL
+	luaz_state_release(L);
+#else
 	lua_close(L);
+#endif
 	return rc;
 }
 
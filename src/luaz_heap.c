@@ -0,0 +1,541 @@
+/**
+ * @file luaz_heap.c
+ * @brief Lua-Zephyr heap: sys_heap-backed Lua allocator with optional slab.
+ *
+ * Lua allocates mostly small objects of a few fixed sizes (strings, tables,
+ * hash nodes, closures, upvalues).  With CONFIG_LUA_ALLOC_SLAB these are
+ * carved in 8-byte size classes out of pages taken from the state's
+ * sys_heap, and recycled through per-class free lists; Lua always passes
+ * the block size as osize on free/realloc, so no per-block header is
+ * needed.  Larger blocks go straight to sys_heap.
+ *
+ * With CONFIG_LUA_ALLOC_STATS the allocator also counts requests per heap;
+ * heaps are listed by the `lua_mem` shell command.  With
+ * CONFIG_LUA_MEM_LIMIT it refuses requests beyond the heap's limit, which
+ * makes Lua run its emergency collection before giving up.
+ */
+
+#include "luaz_heap.h"
+
+#include <lauxlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#ifdef CONFIG_SHELL
+#include <zephyr/shell/shell.h>
+#endif
+
+#ifdef CONFIG_LUA_ALLOC_STATS
+/** @brief Every heap passed to luaz_heap_init(), for the `lua_mem` command. */
+static sys_slist_t heap_list = SYS_SLIST_STATIC_INIT(&heap_list);
+
+/** @brief Guards heap_list. */
+static struct k_spinlock heap_list_lock;
+#endif
+
+void luaz_heap_init(struct luaz_heap *h, const char *name, void *mem, size_t size)
+{
+	sys_heap_init(&h->heap, mem, size);
+
+#ifdef CONFIG_LUA_ALLOC_STATS
+	k_spinlock_key_t key = k_spin_lock(&heap_list_lock);
+	sys_snode_t *prev;
+
+	h->name = name;
+	h->stats = (struct luaz_heap_stats){0};
+	if (!sys_slist_find(&heap_list, &h->node, &prev)) {
+		sys_slist_append(&heap_list, &h->node);
+	}
+
+	k_spin_unlock(&heap_list_lock, key);
+#else
+	ARG_UNUSED(name);
+#endif
+
+#ifdef LUAZ_HEAP_TRACK_USE
+	h->size = size;
+	h->in_use = 0;
+#endif
+
+#ifdef CONFIG_LUA_MEM_LIMIT
+	h->gc_pressure = false;
+	luaz_heap_set_limit(h, 0);
+#endif
+
+#ifdef CONFIG_LUA_IDLE_GC
+	h->idle_gc_steps = 0;
+	h->idle_gc_cycles = 0;
+	h->idle_gc_us = 0;
+	h->idle_gc_base = 0;
+#endif
+
+#ifdef CONFIG_LUA_ALLOC_SLAB
+	memset(h->free_list, 0, sizeof(h->free_list));
+	h->page_pos = NULL;
+	h->page_left = 0;
+#endif
+}
+
+#ifdef CONFIG_LUA_ALLOC_SLAB
+
+BUILD_ASSERT(CONFIG_LUA_ALLOC_SLAB_MAX_SIZE % LUAZ_SLAB_ALIGN == 0,
+	     "CONFIG_LUA_ALLOC_SLAB_MAX_SIZE must be a multiple of 8");
+BUILD_ASSERT(CONFIG_LUA_ALLOC_SLAB_PAGE_SIZE % LUAZ_SLAB_ALIGN == 0,
+	     "CONFIG_LUA_ALLOC_SLAB_PAGE_SIZE must be a multiple of 8");
+
+/** @brief Size class of a @p size byte block, or -1 if not a slab block. */
+static inline int slab_class(size_t size)
+{
+	if (size == 0 || size > CONFIG_LUA_ALLOC_SLAB_MAX_SIZE) {
+		return -1;
+	}
+
+	return (size - 1) / LUAZ_SLAB_ALIGN;
+}
+
+/** @brief Block size of size class @p cls. */
+static inline size_t slab_size(int cls)
+{
+	return (cls + 1) * LUAZ_SLAB_ALIGN;
+}
+
+/** @brief Return a block to the free list of its size class. */
+static inline void slab_free(struct luaz_heap *h, void *blk, int cls)
+{
+	*(void **)blk = h->free_list[cls];
+	h->free_list[cls] = blk;
+}
+
+/**
+ * @brief Take a block of size class @p cls.
+ *
+ * Pops the class free list, else carves from the current page, else starts
+ * a new page.  When sys_heap has no room for a page, a free block of a
+ * larger class is split instead; all slab blocks stay page-backed so any
+ * of them can serve its class.
+ *
+ * @return The block, or NULL when out of memory.
+ */
+static void *slab_alloc(struct luaz_heap *h, int cls)
+{
+	size_t size = slab_size(cls);
+	uint8_t *blk = h->free_list[cls];
+
+	if (blk != NULL) {
+		h->free_list[cls] = *(void **)blk;
+		return blk;
+	}
+
+	if (h->page_left < size) {
+		uint8_t *page = sys_heap_alloc(&h->heap, CONFIG_LUA_ALLOC_SLAB_PAGE_SIZE);
+
+		if (page == NULL) {
+			for (int c = cls + 1; c < LUAZ_SLAB_CLASSES; c++) {
+				blk = h->free_list[c];
+				if (blk != NULL) {
+					h->free_list[c] = *(void **)blk;
+					slab_free(h, blk + size, c - cls - 1);
+					return blk;
+				}
+			}
+			return NULL;
+		}
+
+		/* Keep the tail of the previous page as a smaller block */
+		if (h->page_left > 0) {
+			slab_free(h, h->page_pos, slab_class(h->page_left));
+		}
+
+		h->page_pos = page;
+		h->page_left = CONFIG_LUA_ALLOC_SLAB_PAGE_SIZE;
+	}
+
+	blk = h->page_pos;
+	h->page_pos += size;
+	h->page_left -= size;
+
+	return blk;
+}
+
+#endif /* CONFIG_LUA_ALLOC_SLAB */
+
+/**
+ * @brief Allocate, resize or free a block of a Lua heap (lua_Alloc semantics).
+ *
+ * @param h Heap the block belongs to
+ * @param ptr A pointer to the object that's going to be allocated/rellocated
+ * @param osize The old size of the memory region that ptr points to
+ * @param nsize The desired new size of the memory region that ptr points to
+ */
+static void *heap_realloc(struct luaz_heap *h, void *ptr, size_t osize, size_t nsize)
+{
+	void *res = NULL;
+
+#ifdef CONFIG_LUA_ALLOC_SLAB
+	/* osize is an object type tag, not a size, when ptr is NULL */
+	int ocls = ptr != NULL ? slab_class(osize) : -1;
+	int ncls = slab_class(nsize);
+
+	if (ocls >= 0 || ncls >= 0) {
+		if (ocls == ncls) {
+			return ptr;
+		}
+
+		if (nsize > 0) {
+			res = ncls >= 0 ? slab_alloc(h, ncls) : sys_heap_alloc(&h->heap, nsize);
+			if (res == NULL) {
+				/* Lua keeps the old block and runs an emergency GC */
+				return NULL;
+			}
+		}
+
+		if (ptr != NULL) {
+			/* res is NULL when freeing: nothing to copy */
+			if (res != NULL) {
+				memcpy(res, ptr, MIN(osize, nsize));
+			}
+			if (ocls >= 0) {
+				slab_free(h, ptr, ocls);
+			} else {
+				sys_heap_free(&h->heap, ptr);
+			}
+		}
+
+		return res;
+	}
+#endif
+
+	if (nsize == 0) {
+		if (ptr != NULL) {
+			sys_heap_free(&h->heap, ptr);
+		}
+
+	} else {
+		/* NULL makes Lua run an emergency collection and retry */
+		res = sys_heap_realloc(&h->heap, ptr, nsize);
+	}
+
+	return res;
+}
+
+#ifdef CONFIG_LUA_ALLOC_STATS
+
+/** @brief Power-of-two histogram bucket of a @p size byte request. */
+static inline int hist_bucket(size_t size)
+{
+	int b = 31 - __builtin_clz((uint32_t)MAX(size, 1));
+
+	return MIN(b, LUAZ_HEAP_HIST_BUCKETS - 1);
+}
+
+/** @brief Account one allocator call in the heap statistics. */
+static void stats_update(struct luaz_heap *h, void *ptr, size_t osize, size_t nsize, void *res)
+{
+	struct luaz_heap_stats *st = &h->stats;
+
+	if (nsize == 0) {
+		if (ptr != NULL) {
+			st->frees++;
+		}
+		return;
+	}
+
+	st->size_hist[hist_bucket(nsize)]++;
+
+	if (res == NULL) {
+		st->failures++;
+		return;
+	}
+
+	if (ptr == NULL) {
+		/* osize is the type tag of a new object, anything else is "other" */
+		st->allocs++;
+		st->type_bytes[osize < LUAZ_HEAP_TYPES ? osize : LUA_TNIL] += nsize;
+	} else {
+		st->reallocs++;
+	}
+
+	st->peak = MAX(st->peak, h->in_use);
+}
+
+#endif /* CONFIG_LUA_ALLOC_STATS */
+
+/**
+ * @brief The custom allocator that Lua will use to dynamically allocate all
+relevant data in the context
+ *
+ * @param ud User data, the struct luaz_heap the allocator will use
+ * @param ptr A pointer to the object that's going to be allocated/rellocated
+ * @param osize The old size of the memory region that ptr points to
+ * @param nsize The desired new size of the memory region that ptr points to
+ */
+void *lua_zephyr_allocator(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	struct luaz_heap *h = ud;
+	void *res;
+
+#ifdef LUAZ_HEAP_TRACK_USE
+	/* osize is an object type tag, not a size, when ptr is NULL */
+	size_t old = ptr != NULL ? osize : 0;
+#endif
+
+#ifdef CONFIG_LUA_MEM_LIMIT
+	if (nsize > old && h->in_use - old + nsize > h->limit) {
+		res = NULL;
+	} else
+#endif
+	{
+		res = heap_realloc(h, ptr, osize, nsize);
+	}
+
+#ifdef LUAZ_HEAP_TRACK_USE
+	if (res != NULL || nsize == 0) {
+		h->in_use += nsize - old;
+	}
+#endif
+
+#ifdef CONFIG_LUA_ALLOC_STATS
+	stats_update(h, ptr, osize, nsize, res);
+#endif
+
+	return res;
+}
+
+/** @brief Print thread memory usage report (heap and stack) as a table. */
+void luaz_print_mem_usage(struct luaz_heap *h, size_t heap_size)
+{
+	ARG_UNUSED(h);
+	ARG_UNUSED(heap_size);
+
+	printk("-- Lua thread memory report:\n");
+	printk("       %6s  %8s  %8s  %5s\n", "size", "max used", "unused", "usage");
+
+#ifdef CONFIG_SYS_HEAP_RUNTIME_STATS
+	{
+		struct sys_memory_stats stats;
+
+		sys_heap_runtime_stats_get(&h->heap, &stats);
+		printk("heap:  %6zu  %8zu  %8zu  %4u%%\n", heap_size, stats.max_allocated_bytes,
+		       stats.free_bytes,
+		       (unsigned int)(stats.max_allocated_bytes * 100U / heap_size));
+	}
+#endif
+
+#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
+	{
+		size_t unused;
+		const struct k_thread *t = k_current_get();
+
+		if (k_thread_stack_space_get(t, &unused) == 0) {
+			size_t size = t->stack_info.size;
+			size_t used = size - unused;
+
+			printk("stack: %6zu  %8zu  %8zu  %4u%%\n", size, used, unused,
+			       (unsigned int)(used * 100U / size));
+		}
+	}
+#endif
+}
+
+#if defined(CONFIG_LUA_ALLOC_STATS) || defined(CONFIG_LUA_MEM_LIMIT)
+/** @brief Heap of a Lua state: the user data of its allocator. */
+static struct luaz_heap *state_heap(lua_State *L)
+{
+	void *ud;
+
+	lua_getallocf(L, &ud);
+
+	return ud;
+}
+#endif
+
+#ifdef CONFIG_LUA_MEM_LIMIT
+
+void luaz_heap_set_limit(struct luaz_heap *h, size_t limit)
+{
+	h->limit = limit > 0 ? limit : h->size;
+	h->pressure_mark = h->limit / 100 * CONFIG_LUA_MEM_PRESSURE_PERCENT;
+}
+
+void luaz_heap_gc_check(lua_State *L)
+{
+	struct luaz_heap *h = state_heap(L);
+	bool pressure = h->in_use > h->pressure_mark;
+
+	if (pressure != h->gc_pressure) {
+		if (pressure) {
+			h->saved_pause = lua_gc(L, LUA_GCPARAM, LUA_GCPPAUSE,
+						CONFIG_LUA_MEM_PRESSURE_GC_PAUSE);
+		} else {
+			lua_gc(L, LUA_GCPARAM, LUA_GCPPAUSE, h->saved_pause);
+		}
+		h->gc_pressure = pressure;
+	}
+
+	if (pressure) {
+		lua_gc(L, LUA_GCSTEP, 0);
+	}
+}
+
+/** @brief Lua function: zephyr.mem_limit([bytes]) -> limit, in_use, pressure. */
+int luaz_heap_mem_limit(lua_State *L)
+{
+	struct luaz_heap *h = state_heap(L);
+
+	if (!lua_isnoneornil(L, 1)) {
+		lua_Integer limit = luaL_checkinteger(L, 1);
+
+		luaL_argcheck(L, limit >= 0, 1, "negative limit");
+		luaz_heap_set_limit(h, limit);
+	}
+
+	lua_pushinteger(L, h->limit);
+	lua_pushinteger(L, h->in_use);
+	lua_pushboolean(L, h->in_use > h->pressure_mark);
+
+	return 3;
+}
+
+#endif /* CONFIG_LUA_MEM_LIMIT */
+
+#ifdef CONFIG_LUA_ALLOC_STATS
+
+/** @brief Names of the tracked Lua types; LUA_TNIL counts other allocations. */
+static const char *const type_names[LUAZ_HEAP_TYPES] = {
+	[LUA_TNIL] = "other",
+	[LUA_TSTRING] = "string",
+	[LUA_TTABLE] = "table",
+	[LUA_TFUNCTION] = "function",
+	[LUA_TUSERDATA] = "userdata",
+	[LUA_TTHREAD] = "thread",
+};
+
+/** @brief Lua function: zephyr.mem_stats() -> table of the calling state's heap. */
+int luaz_heap_mem_stats(lua_State *L)
+{
+	const struct luaz_heap *h = state_heap(L);
+	/* Copy first: building the result table allocates */
+	struct luaz_heap_stats st = h->stats;
+	size_t in_use = h->in_use;
+
+	lua_createtable(L, 0, 9);
+	lua_pushinteger(L, st.allocs);
+	lua_setfield(L, -2, "allocs");
+	lua_pushinteger(L, st.frees);
+	lua_setfield(L, -2, "frees");
+	lua_pushinteger(L, st.reallocs);
+	lua_setfield(L, -2, "reallocs");
+	lua_pushinteger(L, st.failures);
+	lua_setfield(L, -2, "failures");
+	lua_pushinteger(L, in_use);
+	lua_setfield(L, -2, "in_use");
+	lua_pushinteger(L, st.peak);
+	lua_setfield(L, -2, "peak");
+	lua_pushinteger(L, h->size);
+	lua_setfield(L, -2, "size");
+
+	lua_createtable(L, LUAZ_HEAP_HIST_BUCKETS, 0);
+	for (int i = 0; i < LUAZ_HEAP_HIST_BUCKETS; i++) {
+		lua_pushinteger(L, st.size_hist[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "hist");
+
+	lua_createtable(L, 0, 6);
+	for (int t = 0; t < LUAZ_HEAP_TYPES; t++) {
+		if (type_names[t] != NULL) {
+			lua_pushinteger(L, st.type_bytes[t]);
+			lua_setfield(L, -2, type_names[t]);
+		}
+	}
+	lua_setfield(L, -2, "types");
+
+	return 1;
+}
+
+#ifdef CONFIG_SHELL
+
+/** @brief Print the detailed statistics of one heap. */
+static void print_heap_details(const struct shell *sh, const char *name, size_t size,
+			       size_t in_use, const struct luaz_heap_stats *st)
+{
+	shell_print(sh, "%s: %zu/%zu bytes in use, peak %zu", name, in_use, size, st->peak);
+	shell_print(sh, "  allocs %u  frees %u  reallocs %u  failures %u", st->allocs, st->frees,
+		    st->reallocs, st->failures);
+
+	shell_print(sh, "  request size histogram:");
+	for (int i = 0; i < LUAZ_HEAP_HIST_BUCKETS; i++) {
+		if (st->size_hist[i] == 0) {
+			continue;
+		}
+		if (i == LUAZ_HEAP_HIST_BUCKETS - 1) {
+			shell_print(sh, "    %6u+       %8u", 1U << i, st->size_hist[i]);
+		} else {
+			shell_print(sh, "    %6u-%-6u %8u", 1U << i, (2U << i) - 1, st->size_hist[i]);
+		}
+	}
+
+	shell_print(sh, "  bytes allocated per type:");
+	for (int t = 0; t < LUAZ_HEAP_TYPES; t++) {
+		if (type_names[t] != NULL) {
+			shell_print(sh, "    %-8s %8zu", type_names[t], st->type_bytes[t]);
+		}
+	}
+}
+
+/** @brief Shell command: lua_mem [name] — Lua heap statistics (all heaps, or one in detail). */
+static int cmd_lua_mem(const struct shell *sh, size_t argc, char **argv)
+{
+	sys_snode_t *node = NULL;
+	bool found = false;
+
+	if (argc < 2) {
+		shell_print(sh, "%-16s %8s %8s %8s %8s", "heap", "size", "in use", "peak",
+			    "failures");
+	}
+
+	/*
+	 * Heaps are never removed, so the walk can hold its place across
+	 * unlocks; each link is read under the lock as luaz_heap_init() may be
+	 * appending. Counters of a running state may be mid-update.
+	 */
+	for (;;) {
+		k_spinlock_key_t key = k_spin_lock(&heap_list_lock);
+
+		node = node == NULL ? sys_slist_peek_head(&heap_list) : sys_slist_peek_next(node);
+		if (node == NULL) {
+			k_spin_unlock(&heap_list_lock, key);
+			break;
+		}
+
+		struct luaz_heap *h = CONTAINER_OF(node, struct luaz_heap, node);
+		struct luaz_heap_stats st = h->stats;
+		size_t in_use = h->in_use;
+		const char *name = h->name;
+		size_t size = h->size;
+
+		/* Print outside of the lock */
+		k_spin_unlock(&heap_list_lock, key);
+
+		if (argc < 2) {
+			shell_print(sh, "%-16s %8zu %8zu %8zu %8u", name, size, in_use, st.peak,
+				    st.failures);
+		} else if (strcmp(name, argv[1]) == 0) {
+			print_heap_details(sh, name, size, in_use, &st);
+			found = true;
+		}
+	}
+
+	if (argc >= 2 && !found) {
+		shell_error(sh, "No Lua heap named %s", argv[1]);
+		return -ENOENT;
+	}
+
+	return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(lua_mem, NULL, "Lua heap statistics: lua_mem [heap name]", cmd_lua_mem, 1,
+		       1);
+
+#endif /* CONFIG_SHELL */
+
+#endif /* CONFIG_LUA_ALLOC_STATS */
@@ -2,8 +2,20 @@
  * @file luaz_msg_descr.c
  * @brief Descriptor-based Lua <-> C struct conversion for zbus messages.
  *
- * Provides lua_msg_descr_to_table and lua_msg_descr_from_table helper
- * functions used by lua_zbus.c via the channel user_data descriptor lookup.
+ * Provides lua_msg_descr_to_table, lua_msg_descr_fill_table and
+ * lua_msg_descr_from_table helper functions used by lua_zbus.c via the
+ * channel user_data descriptor lookup.
+ *
+ * A descriptor tree is compiled once per Lua state by lua_msg_descr_bind()
+ * into a flat program: one opcode per field, specialized by type and size,
+ * with absolute struct offsets and ENTER/LEAVE pairs around nested objects.
+ * Field names are interned at the same time and kept in the program's user
+ * value, so the conversions are tight loops over the op array that index
+ * tables with ready-made keys, without recursion or per-field type/size
+ * dispatch.  Decoding falls back to __index defaults tables, as
+ * lua_getfield does, but never calls an __index function (see get_field());
+ * encoding writes with lua_rawset.  Numeric and boolean arrays
+ * are converted in bulk by one type-specialized loop per array.
  */
 
 #include <luaz_msg_descr.h>
@@ -11,12 +23,679 @@
 #include <string.h>
 #include <zephyr/kernel.h>
 
+/** @brief Opcodes of a compiled descriptor program. */
+enum lua_msg_opcode {
+	OP_I8,
+	OP_I16,
+	OP_I32,
+	OP_I64,
+	OP_U8,
+	OP_U16,
+	OP_U32,
+	OP_U64,
+	OP_F32,
+	OP_F64,
+	OP_STR,
+	OP_STRBUF,
+	OP_BOOL,
+	OP_ENTER, /* push subtable, arg = index of the matching OP_LEAVE */
+	OP_LEAVE,
+	OP_ARRAY, /* followed by one extension op, see descr_compile() */
+	OP_NOP,   /* field of an unknown type/size, skipped */
+};
+
+/** @brief One instruction of a compiled descriptor program. */
+struct lua_msg_op {
+	uint8_t code;
+	/** Field-name key index in the program's key sequence (1-based). */
+	uint16_t key;
+	/** Offset from the root struct, nested offsets already added. */
+	uint16_t offset;
+	/** OP_STRBUF: buffer size; OP_ENTER: field count or LEAVE index. */
+	uint16_t arg;
+};
+
+/**
+ * @brief Compiled descriptor program (Lua full userdata).
+ *
+ * User value 1 holds the interned field-name keys, indexed by op.key.
+ * User value 2 maps each top-level field name to its 1-based position in
+ * the descriptor array, for single-field access.
+ */
+struct lua_msg_prog {
+	uint16_t op_count;
+	uint8_t max_depth;
+	struct lua_msg_op ops[];
+};
+
+/**
+ * @brief Registry key of the per-state program cache.
+ *
+ * The cache maps a field descriptor array (light userdata) to its compiled
+ * struct lua_msg_prog userdata.
+ */
+static const char descr_prog_cache_key;
+
+/** @brief Map a scalar field type and size to its specialized opcode. */
+static uint8_t field_opcode(enum lua_msg_field_type type, size_t size)
+{
+	switch (type) {
+	case LUA_MSG_TYPE_INT:
+		switch (size) {
+		case 1:
+			return OP_I8;
+		case 2:
+			return OP_I16;
+		case 4:
+			return OP_I32;
+		case 8:
+			return OP_I64;
+		}
+		break;
+	case LUA_MSG_TYPE_UINT:
+		switch (size) {
+		case 1:
+			return OP_U8;
+		case 2:
+			return OP_U16;
+		case 4:
+			return OP_U32;
+		case 8:
+			return OP_U64;
+		}
+		break;
+	case LUA_MSG_TYPE_NUMBER:
+		return size == sizeof(float) ? OP_F32 : OP_F64;
+	case LUA_MSG_TYPE_STRING:
+		return OP_STR;
+	case LUA_MSG_TYPE_STRING_BUF:
+		return OP_STRBUF;
+	case LUA_MSG_TYPE_BOOL:
+		return OP_BOOL;
+	default:
+		break;
+	}
+
+	return OP_NOP;
+}
+
+/**
+ * @brief Build the extension op that describes an array field's layout.
+ *
+ * @param f     Array field descriptor.
+ * @param base  Offset of the struct holding @p f from the root struct.
+ * @return Extension op, see descr_compile().
+ */
+static struct lua_msg_op array_ext_op(const struct lua_msg_field_descr *f, uint16_t base)
+{
+	bool fixed = f->count_offset == LUA_MSG_ARRAY_FIXED;
+
+	return (struct lua_msg_op){
+		.code = field_opcode(f->elem_type, f->size),
+		.key = fixed ? 0 : f->count_size,
+		.offset = fixed ? 0 : base + f->count_offset,
+		.arg = f->max_count,
+	};
+}
+
+/** @brief One level of the compiler's explicit descriptor walk. */
+struct descr_walk_frame {
+	const struct lua_msg_field_descr *fields;
+	size_t count;
+	size_t next;
+	uint16_t base;
+	uint16_t enter_pc;
+};
+
+/**
+ * @brief Flatten a descriptor tree into @p prog, or just count its ops.
+ *
+ * Walks the tree iteratively, so compile-time stack use is bounded by
+ * CONFIG_LUA_MSG_DESCR_MAX_DEPTH rather than by the nesting of the tree.
+ * When @p prog is NULL only the op count is computed; otherwise ops are
+ * written and the field-name keys are appended to the sequence on top of
+ * the Lua stack.
+ *
+ * An OP_ARRAY op is followed by an extension op that carries the array
+ * layout: code is the element opcode, key the size of the count field
+ * (0 for fixed-length arrays), offset the absolute offset of the count
+ * field and arg the capacity.
+ *
+ * @param L            Lua state (key sequence on top when @p prog != NULL).
+ * @param fields       Root field descriptor array.
+ * @param field_count  Number of root fields.
+ * @param prog         Destination program, or NULL to count.
+ * @return Number of ops, or -1 if the tree nests too deeply.
+ */
+static int descr_compile(lua_State *L, const struct lua_msg_field_descr *fields,
+			 size_t field_count, struct lua_msg_prog *prog)
+{
+	struct descr_walk_frame stack[CONFIG_LUA_MSG_DESCR_MAX_DEPTH + 1];
+	int depth = 0;
+	int pc = 0;
+
+	stack[0] = (struct descr_walk_frame){.fields = fields, .count = field_count};
+
+	while (depth >= 0) {
+		struct descr_walk_frame *fr = &stack[depth];
+
+		if (fr->next == fr->count) {
+			if (depth > 0 && prog != NULL) {
+				prog->ops[pc] = (struct lua_msg_op){.code = OP_LEAVE};
+				prog->ops[fr->enter_pc].arg = pc;
+			}
+			pc += depth > 0;
+			depth--;
+			continue;
+		}
+
+		const struct lua_msg_field_descr *f = &fr->fields[fr->next++];
+		uint16_t offset = fr->base + f->offset;
+
+		if (prog != NULL) {
+			uint8_t code;
+
+			if (f->type == LUA_MSG_TYPE_OBJECT) {
+				code = OP_ENTER;
+			} else if (f->type == LUA_MSG_TYPE_ARRAY) {
+				code = OP_ARRAY;
+			} else {
+				code = field_opcode(f->type, f->size);
+			}
+
+			lua_pushstring(L, f->field_name);
+			lua_rawseti(L, -2, pc + 1);
+			prog->ops[pc] = (struct lua_msg_op){
+				.code = code,
+				.key = pc + 1,
+				.offset = offset,
+				.arg = f->size,
+			};
+		}
+
+		if (f->type == LUA_MSG_TYPE_ARRAY) {
+			pc++;
+			if (prog != NULL) {
+				prog->ops[pc] = array_ext_op(f, fr->base);
+			}
+		}
+
+		if (f->type == LUA_MSG_TYPE_OBJECT) {
+			if (depth == CONFIG_LUA_MSG_DESCR_MAX_DEPTH) {
+				return -1;
+			}
+			if (prog != NULL && depth + 1 > prog->max_depth) {
+				prog->max_depth = depth + 1;
+			}
+			stack[++depth] = (struct descr_walk_frame){
+				.fields = f->sub_fields,
+				.count = f->sub_field_count,
+				.base = offset,
+				.enter_pc = pc,
+			};
+		}
+		pc++;
+	}
+
+	return pc;
+}
+
+/**
+ * @brief Push the compiled program of a descriptor array.
+ *
+ * Looks the array up in the program cache and compiles it on first use.
+ *
+ * @param L            Lua state.
+ * @param fields       Array of field descriptors.
+ * @param field_count  Number of fields.
+ * @return The program; its userdata is left on top of the stack.
+ */
+static const struct lua_msg_prog *push_prog(lua_State *L, const struct lua_msg_field_descr *fields,
+					    size_t field_count)
+{
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &descr_prog_cache_key) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &descr_prog_cache_key);
+	}
+
+	if (lua_rawgetp(L, -1, fields) != LUA_TUSERDATA) {
+		lua_pop(L, 1);
+
+		int op_count = descr_compile(L, fields, field_count, NULL);
+
+		if (op_count < 0) {
+			luaL_error(L, "message descriptor nests deeper than %d",
+				   CONFIG_LUA_MSG_DESCR_MAX_DEPTH);
+		}
+
+		struct lua_msg_prog *prog = lua_newuserdatauv(
+			L, sizeof(*prog) + op_count * sizeof(struct lua_msg_op), 2);
+
+		prog->op_count = op_count;
+		prog->max_depth = 0;
+
+		lua_createtable(L, op_count, 0);
+		descr_compile(L, fields, field_count, prog);
+		lua_setiuservalue(L, -2, 1);
+
+		lua_createtable(L, 0, (int)field_count);
+		for (size_t i = 0; i < field_count; i++) {
+			lua_pushstring(L, fields[i].field_name);
+			lua_pushinteger(L, (lua_Integer)i + 1);
+			lua_rawset(L, -3);
+		}
+		lua_setiuservalue(L, -2, 2);
+
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, -3, fields);
+	}
+
+	lua_remove(L, -2); /* pop cache table */
+
+	return lua_touserdata(L, -1);
+}
+
+/**
+ * @brief Push the Lua value of a scalar field.
+ *
+ * @param L     Lua state.
+ * @param code  Scalar opcode of the field (OP_NOP pushes nil).
+ * @param p     Pointer to the field inside the C struct.
+ */
+static void push_scalar(lua_State *L, uint8_t code, const void *p)
+{
+	switch (code) {
+	case OP_I8:
+		lua_pushinteger(L, *(const int8_t *)p);
+		break;
+	case OP_I16:
+		lua_pushinteger(L, *(const int16_t *)p);
+		break;
+	case OP_I32:
+		lua_pushinteger(L, *(const int32_t *)p);
+		break;
+	case OP_I64:
+		lua_pushinteger(L, *(const int64_t *)p);
+		break;
+	case OP_U8:
+		lua_pushinteger(L, *(const uint8_t *)p);
+		break;
+	case OP_U16:
+		lua_pushinteger(L, *(const uint16_t *)p);
+		break;
+	case OP_U32:
+		lua_pushinteger(L, *(const uint32_t *)p);
+		break;
+	case OP_U64:
+		lua_pushinteger(L, (lua_Integer)(*(const uint64_t *)p));
+		break;
+	case OP_F32:
+		lua_pushnumber(L, *(const float *)p);
+		break;
+	case OP_F64:
+		lua_pushnumber(L, *(const double *)p);
+		break;
+	case OP_STR:
+		lua_pushstring(L, *(const char *const *)p);
+		break;
+	case OP_STRBUF:
+		lua_pushstring(L, (const char *)p);
+		break;
+	case OP_BOOL:
+		lua_pushboolean(L, *(const bool *)p);
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+}
+
+/**
+ * @brief Convert a Lua value and store it into a scalar field.
+ *
+ * @param L     Lua state.
+ * @param code  Scalar opcode of the field (OP_NOP stores nothing).
+ * @param p     Pointer to the field inside the C struct.
+ * @param size  Field size (buffer size for OP_STRBUF).
+ * @param idx   Stack index of the value.
+ */
+static void store_scalar(lua_State *L, uint8_t code, void *p, size_t size, int idx)
+{
+	switch (code) {
+	case OP_I8:
+	case OP_U8:
+		*(uint8_t *)p = (uint8_t)lua_tointeger(L, idx);
+		break;
+	case OP_I16:
+	case OP_U16:
+		*(uint16_t *)p = (uint16_t)lua_tointeger(L, idx);
+		break;
+	case OP_I32:
+	case OP_U32:
+		*(uint32_t *)p = (uint32_t)lua_tointeger(L, idx);
+		break;
+	case OP_I64:
+	case OP_U64:
+		*(uint64_t *)p = (uint64_t)lua_tointeger(L, idx);
+		break;
+	case OP_F32:
+		*(float *)p = (float)lua_tonumber(L, idx);
+		break;
+	case OP_F64:
+		*(double *)p = (double)lua_tonumber(L, idx);
+		break;
+	case OP_STR:
+		*(const char **)p = lua_tostring(L, idx);
+		break;
+	case OP_STRBUF: {
+		const char *s = lua_tostring(L, idx);
+
+		if (s) {
+			strncpy((char *)p, s, size - 1);
+			((char *)p)[size - 1] = '\0';
+		}
+		break;
+	}
+	case OP_BOOL:
+		*(bool *)p = lua_toboolean(L, idx);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Number of used elements of an array field.
+ *
+ * @param b    Base pointer to the root C struct.
+ * @param ext  Extension op of the OP_ARRAY instruction.
+ * @return The count field clamped to the capacity, or the capacity for a
+ *         fixed-length array.
+ */
+static size_t array_count_get(const uint8_t *b, const struct lua_msg_op *ext)
+{
+	const void *p = b + ext->offset;
+	size_t n;
+
+	switch (ext->key) {
+	case 1:
+		n = *(const uint8_t *)p;
+		break;
+	case 2:
+		n = *(const uint16_t *)p;
+		break;
+	case 4:
+		n = *(const uint32_t *)p;
+		break;
+	default:
+		return ext->arg;
+	}
+
+	return MIN(n, ext->arg);
+}
+
+/**
+ * @brief Store the number of used elements of a counted array field.
+ *
+ * Does nothing for a fixed-length array.
+ *
+ * @param b    Base pointer to the root C struct.
+ * @param ext  Extension op of the OP_ARRAY instruction.
+ * @param n    Element count.
+ */
+static void array_count_set(uint8_t *b, const struct lua_msg_op *ext, size_t n)
+{
+	void *p = b + ext->offset;
+
+	switch (ext->key) {
+	case 1:
+		*(uint8_t *)p = n;
+		break;
+	case 2:
+		*(uint16_t *)p = n;
+		break;
+	case 4:
+		*(uint32_t *)p = n;
+		break;
+	default:
+		break;
+	}
+}
+
+/* One tight loop per element type: C array -> Lua sequence */
+#define ARRAY_TO_LUA(_ctype, _push)                                     \
+	for (size_t i = 0; i < n; i++) {                                \
+		_push(L, ((const _ctype *)p)[i]);                       \
+		lua_rawseti(L, t, (lua_Integer)i + 1);                  \
+	}
+
+/**
+ * @brief Store @p n C array elements into the sequence at @p t.
+ *
+ * Entries past @p n left over from a previous, longer fill are cleared so
+ * the sequence length always matches the element count.
+ *
+ * @param L     Lua state.
+ * @param t     Absolute stack index of the destination table.
+ * @param code  Element opcode.
+ * @param p     Pointer to the first element.
+ * @param n     Number of elements.
+ */
+static void array_to_lua(lua_State *L, int t, uint8_t code, const void *p, size_t n)
+{
+	switch (code) {
+	case OP_I8:
+		ARRAY_TO_LUA(int8_t, lua_pushinteger);
+		break;
+	case OP_I16:
+		ARRAY_TO_LUA(int16_t, lua_pushinteger);
+		break;
+	case OP_I32:
+		ARRAY_TO_LUA(int32_t, lua_pushinteger);
+		break;
+	case OP_I64:
+		ARRAY_TO_LUA(int64_t, lua_pushinteger);
+		break;
+	case OP_U8:
+		ARRAY_TO_LUA(uint8_t, lua_pushinteger);
+		break;
+	case OP_U16:
+		ARRAY_TO_LUA(uint16_t, lua_pushinteger);
+		break;
+	case OP_U32:
+		ARRAY_TO_LUA(uint32_t, lua_pushinteger);
+		break;
+	case OP_U64:
+		ARRAY_TO_LUA(uint64_t, lua_pushinteger);
+		break;
+	case OP_F32:
+		ARRAY_TO_LUA(float, lua_pushnumber);
+		break;
+	case OP_F64:
+		ARRAY_TO_LUA(double, lua_pushnumber);
+		break;
+	case OP_BOOL:
+		ARRAY_TO_LUA(bool, lua_pushboolean);
+		break;
+	default:
+		n = 0;
+		break;
+	}
+
+	for (lua_Integer i = (lua_Integer)n + 1; lua_rawgeti(L, t, i) != LUA_TNIL; i++) {
+		lua_pop(L, 1);
+		lua_pushnil(L);
+		lua_rawseti(L, t, i);
+	}
+	lua_pop(L, 1);
+}
+
+#undef ARRAY_TO_LUA
+
+/* One tight loop per element type: Lua sequence -> C array */
+#define ARRAY_FROM_LUA(_ctype, _to)                                     \
+	for (size_t i = 0; i < n; i++) {                                \
+		lua_rawgeti(L, t, (lua_Integer)i + 1);                  \
+		((_ctype *)p)[i] = (_ctype)_to(L, -1);                  \
+		lua_pop(L, 1);                                          \
+	}
+
+/**
+ * @brief Store the first elements of the sequence at @p t into a C array.
+ *
+ * @param L     Lua state.
+ * @param t     Absolute stack index of the source table.
+ * @param code  Element opcode.
+ * @param p     Pointer to the first element.
+ * @param max   Array capacity.
+ * @return Number of elements written (sequence length clamped to @p max).
+ */
+static size_t array_from_lua(lua_State *L, int t, uint8_t code, void *p, size_t max)
+{
+	size_t n = MIN((size_t)lua_rawlen(L, t), max);
+
+	switch (code) {
+	case OP_I8:
+	case OP_U8:
+		ARRAY_FROM_LUA(uint8_t, lua_tointeger);
+		break;
+	case OP_I16:
+	case OP_U16:
+		ARRAY_FROM_LUA(uint16_t, lua_tointeger);
+		break;
+	case OP_I32:
+	case OP_U32:
+		ARRAY_FROM_LUA(uint32_t, lua_tointeger);
+		break;
+	case OP_I64:
+	case OP_U64:
+		ARRAY_FROM_LUA(uint64_t, lua_tointeger);
+		break;
+	case OP_F32:
+		ARRAY_FROM_LUA(float, lua_tonumber);
+		break;
+	case OP_F64:
+		ARRAY_FROM_LUA(double, lua_tonumber);
+		break;
+	case OP_BOOL:
+		ARRAY_FROM_LUA(bool, lua_toboolean);
+		break;
+	default:
+		return 0;
+	}
+
+	return n;
+}
+
+#undef ARRAY_FROM_LUA
+
+/**
+ * @brief Bind a descriptor array to a Lua state.
+ *
+ * Compiles the descriptor tree into its flat program and interns the field
+ * names.  Conversions bind lazily, so this only moves the one-time cost.
+ *
+ * @param L            Lua state.
+ * @param fields       Array of field descriptors.
+ * @param field_count  Number of fields.
+ */
+void lua_msg_descr_bind(lua_State *L, const struct lua_msg_field_descr *fields,
+			size_t field_count)
+{
+	push_prog(L, fields, field_count);
+	lua_pop(L, 1);
+}
+
+/**
+ * @brief Push the field-name index of a descriptor array.
+ *
+ * @param L            Lua state.
+ * @param fields       Array of field descriptors.
+ * @param field_count  Number of fields.
+ */
+void lua_msg_descr_push_field_index(lua_State *L, const struct lua_msg_field_descr *fields,
+				    size_t field_count)
+{
+	push_prog(L, fields, field_count);
+	lua_getiuservalue(L, -1, 2);
+	lua_remove(L, -2);
+}
+
+/**
+ * @brief Decode a single field of a C struct and push its Lua value.
+ *
+ * Scalars are pushed as values, nested objects and arrays as new tables.
+ *
+ * @param L     Lua state.
+ * @param f     Field descriptor.
+ * @param base  Base pointer to the C struct holding @p f.
+ */
+void lua_msg_descr_push_field(lua_State *L, const struct lua_msg_field_descr *f,
+			      const void *base)
+{
+	const uint8_t *p = (const uint8_t *)base + f->offset;
+
+	switch (f->type) {
+	case LUA_MSG_TYPE_OBJECT:
+		lua_msg_descr_to_table(L, f->sub_fields, f->sub_field_count, p);
+		break;
+	case LUA_MSG_TYPE_ARRAY: {
+		struct lua_msg_op ext = array_ext_op(f, 0);
+		size_t n = array_count_get(base, &ext);
+
+		lua_createtable(L, (int)n, 0);
+		array_to_lua(L, lua_gettop(L), ext.code, p, n);
+		break;
+	}
+	default:
+		push_scalar(L, field_opcode(f->type, f->size), p);
+		break;
+	}
+}
+
+/**
+ * @brief Convert a Lua value and store it into a single field of a C struct.
+ *
+ * Nested objects and arrays require a table, which is decoded like
+ * lua_msg_descr_from_table() does.
+ *
+ * @param L     Lua state.
+ * @param f     Field descriptor.
+ * @param base  Base pointer to the C struct holding @p f.
+ * @param idx   Stack index of the value.
+ */
+void lua_msg_descr_store_field(lua_State *L, const struct lua_msg_field_descr *f, void *base,
+			       int idx)
+{
+	uint8_t *p = (uint8_t *)base + f->offset;
+
+	idx = lua_absindex(L, idx);
+
+	switch (f->type) {
+	case LUA_MSG_TYPE_OBJECT:
+		luaL_checktype(L, idx, LUA_TTABLE);
+		lua_msg_descr_from_table(L, f->sub_fields, f->sub_field_count, p, idx);
+		break;
+	case LUA_MSG_TYPE_ARRAY: {
+		struct lua_msg_op ext = array_ext_op(f, 0);
+
+		luaL_checktype(L, idx, LUA_TTABLE);
+		array_count_set(base, &ext, array_from_lua(L, idx, ext.code, p, ext.arg));
+		break;
+	}
+	default:
+		store_scalar(L, field_opcode(f->type, f->size), p, f->size, idx);
+		break;
+	}
+}
+
 /**
  * @brief Encode C struct fields into a Lua table (push to stack).
  *
- * Iterates over @p fields, reads each value from @p base + offset,
- * and pushes a new Lua table with the corresponding key/value pairs.
- * Nested LUA_MSG_TYPE_OBJECT fields recurse into sub-descriptors.
+ * Creates a new table presized for @p field_count entries and fills it
+ * with lua_msg_descr_fill_table().
  *
  * @param L            Lua state.
  * @param fields       Array of field descriptors.
@@ -26,88 +705,147 @@
 void lua_msg_descr_to_table(lua_State *L, const struct lua_msg_field_descr *fields,
 			    size_t field_count, const void *base)
 {
-	lua_newtable(L);
-
-	for (size_t i = 0; i < field_count; i++) {
-		const struct lua_msg_field_descr *f = &fields[i];
-		const void *ptr = (const uint8_t *)base + f->offset;
-
-		switch (f->type) {
-		case LUA_MSG_TYPE_INT: {
-			lua_Integer val = 0;
-
-			switch (f->size) {
-			case 1:
-				val = *(const int8_t *)ptr;
-				break;
-			case 2:
-				val = *(const int16_t *)ptr;
-				break;
-			case 4:
-				val = *(const int32_t *)ptr;
-				break;
-			case 8:
-				val = *(const int64_t *)ptr;
-				break;
-			}
-			lua_pushinteger(L, val);
-			break;
+	lua_createtable(L, 0, (int)field_count);
+	lua_msg_descr_fill_table(L, fields, field_count, base, lua_gettop(L));
+}
+
+/**
+ * @brief Encode C struct fields into an existing Lua table.
+ *
+ * Runs the compiled program of @p fields: each scalar op reads its value
+ * from @p base + offset and raw-sets it under the cached key of the current
+ * table.  OP_ENTER makes the subtable already stored under the key current
+ * (creating it only when missing, so refilling does not allocate) and
+ * OP_LEAVE stores it back into its parent.  OP_ARRAY refills the sequence
+ * under its key the same way.  Each open level keeps exactly
+ * two stack slots (key, subtable), so the parent of a level is found
+ * without any extra bookkeeping.
+ *
+ * @param L            Lua state.
+ * @param fields       Array of field descriptors.
+ * @param field_count  Number of fields.
+ * @param base         Base pointer to the C struct data.
+ * @param table_idx    Absolute Lua stack index of the destination table.
+ */
+void lua_msg_descr_fill_table(lua_State *L, const struct lua_msg_field_descr *fields,
+			      size_t field_count, const void *base, int table_idx)
+{
+	const struct lua_msg_prog *prog = push_prog(L, fields, field_count);
+	const uint8_t *b = base;
+
+	lua_getiuservalue(L, -1, 1);
+	lua_remove(L, -2); /* program stays reachable through the cache */
+
+	int keys_idx = lua_gettop(L);
+	int cur = table_idx;
+	int depth = 0;
+
+	luaL_checkstack(L, 2 * prog->max_depth + 4, "message descriptor");
+
+	for (const struct lua_msg_op *op = prog->ops; op < prog->ops + prog->op_count; op++) {
+		const void *p = b + op->offset;
+
+		if (op->code == OP_LEAVE) {
+			depth--;
+			cur = depth == 0 ? table_idx : cur - 2;
+			lua_rawset(L, cur);
+			continue;
 		}
-		case LUA_MSG_TYPE_UINT: {
-			lua_Integer val = 0;
-
-			switch (f->size) {
-			case 1:
-				val = *(const uint8_t *)ptr;
-				break;
-			case 2:
-				val = *(const uint16_t *)ptr;
-				break;
-			case 4:
-				val = *(const uint32_t *)ptr;
-				break;
-			case 8:
-				val = (lua_Integer)(*(const uint64_t *)ptr);
-				break;
+
+		lua_rawgeti(L, keys_idx, op->key);
+
+		switch (op->code) {
+		case OP_ENTER:
+			lua_pushvalue(L, -1);
+			if (lua_rawget(L, cur) != LUA_TTABLE) {
+				lua_pop(L, 1);
+				lua_newtable(L);
 			}
-			lua_pushinteger(L, val);
-			break;
-		}
-		case LUA_MSG_TYPE_NUMBER: {
-			lua_Number val = 0;
+			cur = lua_gettop(L);
+			depth++;
+			continue;
+		case OP_ARRAY: {
+			const struct lua_msg_op *ext = ++op;
+			size_t n = array_count_get(b, ext);
 
-			if (f->size == sizeof(float)) {
-				val = *(const float *)ptr;
-			} else {
-				val = *(const double *)ptr;
+			lua_pushvalue(L, -1);
+			if (lua_rawget(L, cur) != LUA_TTABLE) {
+				lua_pop(L, 1);
+				lua_createtable(L, (int)n, 0);
 			}
-			lua_pushnumber(L, val);
+			array_to_lua(L, lua_gettop(L), ext->code, p, n);
 			break;
 		}
-		case LUA_MSG_TYPE_STRING:
-			lua_pushstring(L, *(const char *const *)ptr);
-			break;
-		case LUA_MSG_TYPE_STRING_BUF:
-			lua_pushstring(L, (const char *)ptr);
-			break;
-		case LUA_MSG_TYPE_BOOL:
-			lua_pushboolean(L, *(const bool *)ptr);
-			break;
-		case LUA_MSG_TYPE_OBJECT:
-			lua_msg_descr_to_table(L, f->sub_fields, f->sub_field_count, ptr);
+		default:
+			push_scalar(L, op->code, p);
 			break;
 		}
 
-		lua_setfield(L, -2, f->field_name);
+		lua_rawset(L, cur);
 	}
+
+	lua_pop(L, 1); /* pop keys */
+}
+
+/** @brief Longest chain of __index tables get_field() follows. */
+#define INDEX_CHAIN_MAX 4
+
+/**
+ * @brief Get a message field without running Lua code.
+ *
+ * Replaces the key on top of the stack with its value in the table at
+ * @p t.  A missing key is looked up in the metatable's __index while that
+ * is a table, so a defaults table applies as with lua_getfield().  An
+ * __index function is not called and the field reads as nil: the message
+ * is being built in the zbus scratch buffer, and the function could call
+ * zbus itself.
+ *
+ * @param L  Lua state.
+ * @param t  Absolute stack index of the table.
+ * @return Type of the value.
+ */
+static int get_field(lua_State *L, int t)
+{
+	int key = lua_gettop(L);
+	int cur = t;
+
+	lua_pushvalue(L, key);
+	int type = lua_rawget(L, cur);
+
+	for (int i = 0; type == LUA_TNIL && i < INDEX_CHAIN_MAX && lua_getmetatable(L, cur); i++) {
+		/* key [chain...] nil mt -> key [chain...] __index */
+		lua_pushliteral(L, "__index");
+		type = lua_rawget(L, -2);
+		lua_replace(L, -3);
+		lua_pop(L, 1);
+		if (type != LUA_TTABLE) {
+			lua_pop(L, 1);
+			lua_pushnil(L);
+			type = LUA_TNIL;
+			break;
+		}
+		cur = lua_gettop(L);
+		lua_pushvalue(L, key);
+		type = lua_rawget(L, cur);
+	}
+
+	lua_replace(L, key);
+	lua_settop(L, key);
+
+	return type;
 }
 
 /**
  * @brief Decode a Lua table into C struct fields.
  *
- * For each descriptor in @p fields, reads the named key from the Lua table
- * at @p table_idx and writes the converted value into @p base + offset.
- * Missing keys (nil) are silently skipped.
+ * Runs the compiled program of @p fields: each scalar op gets its cached
+ * key from the current table (falling back to an __index defaults table,
+ * see get_field()) and writes the converted value into
+ * @p base + offset.  Missing keys (nil) are silently skipped, and so is a
+ * whole nested object whose key does not hold a table: OP_ENTER then jumps
+ * past its matching OP_LEAVE.  An array takes the leading elements of the
+ * sequence (read raw) up to its capacity and, if counted, records how many
+ * it took.
  *
  * @param L            Lua state.
  * @param fields       Array of field descriptors.
@@ -118,90 +856,62 @@ void lua_msg_descr_to_table(lua_State *L, const struct lua_msg_field_descr *fiel
 void lua_msg_descr_from_table(lua_State *L, const struct lua_msg_field_descr *fields,
 			      size_t field_count, void *base, int table_idx)
 {
-	for (size_t i = 0; i < field_count; i++) {
-		const struct lua_msg_field_descr *f = &fields[i];
-		void *ptr = (uint8_t *)base + f->offset;
+	const struct lua_msg_prog *prog = push_prog(L, fields, field_count);
+	uint8_t *b = base;
 
-		lua_getfield(L, table_idx, f->field_name);
+	lua_getiuservalue(L, -1, 1);
+	lua_remove(L, -2); /* program stays reachable through the cache */
 
-		if (lua_isnil(L, -1)) {
+	int keys_idx = lua_gettop(L);
+	int cur = table_idx;
+	int depth = 0;
+
+	luaL_checkstack(L, prog->max_depth + INDEX_CHAIN_MAX + 4, "message descriptor");
+
+	for (const struct lua_msg_op *op = prog->ops; op < prog->ops + prog->op_count; op++) {
+		void *p = b + op->offset;
+
+		if (op->code == OP_LEAVE) {
 			lua_pop(L, 1);
+			depth--;
+			cur = depth == 0 ? table_idx : cur - 1;
 			continue;
 		}
 
-		switch (f->type) {
-		case LUA_MSG_TYPE_INT: {
-			lua_Integer val = lua_tointeger(L, -1);
-
-			switch (f->size) {
-			case 1:
-				*(int8_t *)ptr = (int8_t)val;
-				break;
-			case 2:
-				*(int16_t *)ptr = (int16_t)val;
-				break;
-			case 4:
-				*(int32_t *)ptr = (int32_t)val;
-				break;
-			case 8:
-				*(int64_t *)ptr = (int64_t)val;
-				break;
-			}
-			break;
-		}
-		case LUA_MSG_TYPE_UINT: {
-			lua_Integer val = lua_tointeger(L, -1);
-
-			switch (f->size) {
-			case 1:
-				*(uint8_t *)ptr = (uint8_t)val;
-				break;
-			case 2:
-				*(uint16_t *)ptr = (uint16_t)val;
-				break;
-			case 4:
-				*(uint32_t *)ptr = (uint32_t)val;
-				break;
-			case 8:
-				*(uint64_t *)ptr = (uint64_t)val;
-				break;
-			}
-			break;
-		}
-		case LUA_MSG_TYPE_NUMBER: {
-			lua_Number val = lua_tonumber(L, -1);
+		lua_rawgeti(L, keys_idx, op->key);
+
+		int t = get_field(L, cur);
 
-			if (f->size == sizeof(float)) {
-				*(float *)ptr = (float)val;
+		if (op->code == OP_ENTER) {
+			if (t == LUA_TTABLE) {
+				cur = lua_gettop(L);
+				depth++;
 			} else {
-				*(double *)ptr = (double)val;
+				lua_pop(L, 1);
+				op = &prog->ops[op->arg];
 			}
-			break;
+			continue;
 		}
-		case LUA_MSG_TYPE_STRING:
-			*(const char **)ptr = lua_tostring(L, -1);
-			break;
-		case LUA_MSG_TYPE_STRING_BUF: {
-			const char *s = lua_tostring(L, -1);
 
-			if (s) {
-				strncpy((char *)ptr, s, f->size - 1);
-				((char *)ptr)[f->size - 1] = '\0';
+		if (op->code == OP_ARRAY) {
+			const struct lua_msg_op *ext = ++op;
+
+			if (t == LUA_TTABLE) {
+				array_count_set(b, ext,
+						array_from_lua(L, lua_gettop(L), ext->code, p, ext->arg));
 			}
-			break;
+			lua_pop(L, 1);
+			continue;
 		}
-		case LUA_MSG_TYPE_BOOL:
-			*(bool *)ptr = lua_toboolean(L, -1);
-			break;
-		case LUA_MSG_TYPE_OBJECT: {
-			int nested_idx = lua_absindex(L, -1);
 
-			lua_msg_descr_from_table(L, f->sub_fields, f->sub_field_count, ptr,
-						 nested_idx);
-			break;
-		}
+		if (t == LUA_TNIL) {
+			lua_pop(L, 1);
+			continue;
 		}
 
+		store_scalar(L, op->code, p, op->arg, -1);
 		lua_pop(L, 1);
 	}
+
+	lua_pop(L, 1); /* pop keys */
 }
@@ -3,8 +3,9 @@
  * @brief Interactive Lua REPL integrated with the Zephyr shell.
  *
  * Registers a `lua` shell command that launches a read-eval-print loop.
- * The REPL runs in its own sys_heap and supports Ctrl+D (exit) and
- * Ctrl+L (clear screen).  Enabled via CONFIG_LUA_REPL.
+ * The REPL runs in its own luaz_heap, or in a pooled state with
+ * CONFIG_LUA_STATE_POOL, and supports Ctrl+D (exit) and Ctrl+L (clear
+ * screen).  Enabled via CONFIG_LUA_REPL.
  */
 
 #ifdef CONFIG_LUA_REPL
@@ -13,6 +14,7 @@
 #include <lualib.h>
 #include <lauxlib.h>
 #include <luaz_utils.h>
+#include <luaz_state_pool.h>
 #include <zephyr/kernel.h>
 #include <zephyr/shell/shell.h>
 #include <zephyr/sys/printk.h>
@@ -27,10 +29,12 @@
 #define FF  0x0C
 
 static struct {
+#ifndef CONFIG_LUA_STATE_POOL
 	struct {
 		char buffer[CONFIG_LUA_THREAD_HEAP_SIZE];
-		struct sys_heap heap;
+		struct luaz_heap heap;
 	} lua_heap;
+#endif
 	char input_line[CONFIG_LUA_REPL_LINE_SIZE];
 } self = {};
 
@@ -113,9 +117,9 @@ static void lua_repl_print(lua_State *L)
 /**
  * @brief Shell command handler that runs the Lua REPL loop.
  *
- * Creates a Lua state backed by a dedicated sys_heap, loads the `zephyr`
- * and `base` libraries, then enters the read-eval-print loop until the
- * user presses Ctrl+D.
+ * Creates a Lua state backed by a dedicated luaz_heap (or takes one from
+ * the state pool), loads the `zephyr` and `base` libraries, then enters the
+ * read-eval-print loop until the user presses Ctrl+D.
  */
 static int lua_repl_cmd(const struct shell *sh, size_t argc, char **argv, void *data)
 {
@@ -125,7 +129,15 @@ static int lua_repl_cmd(const struct shell *sh, size_t argc, char **argv, void *
 
 	bool received_exit = false;
 
-	sys_heap_init(&self.lua_heap.heap, self.lua_heap.buffer, CONFIG_LUA_THREAD_HEAP_SIZE);
+#ifdef CONFIG_LUA_STATE_POOL
+	lua_State *L = luaz_state_acquire(K_NO_WAIT);
+	if (L == NULL) {
+		shell_error(sh, "No free Lua state in the pool");
+		return -EBUSY;
+	}
+#else
+	luaz_heap_init(&self.lua_heap.heap, "repl", self.lua_heap.buffer,
+		       CONFIG_LUA_THREAD_HEAP_SIZE);
 
 	lua_State *L = lua_newstate(lua_zephyr_allocator, &self.lua_heap.heap, 0);
 	if (L == NULL) {
@@ -134,6 +146,9 @@ static int lua_repl_cmd(const struct shell *sh, size_t argc, char **argv, void *
 	}
 
 	luaz_openlibs(L);
+	luaz_gc_configure(L, IS_ENABLED(CONFIG_LUA_GC_GENERATIONAL), CONFIG_LUA_GC_PAUSE,
+			  CONFIG_LUA_GC_STEPMUL, CONFIG_LUA_GC_STEPSIZE);
+#endif
 
 	shell_print(
 		sh,
@@ -144,7 +159,7 @@ static int lua_repl_cmd(const struct shell *sh, size_t argc, char **argv, void *
 		shell_getline(sh, self.input_line, sizeof(self.input_line), &received_exit);
 
 		if (received_exit) {
-			return 0;
+			break;
 		}
 
 		/* new line needed to avoid character superposition from previous input */
@@ -174,8 +189,13 @@ static int lua_repl_cmd(const struct shell *sh, size_t argc, char **argv, void *
 		}
 	}
 
+#ifdef CONFIG_LUA_STATE_POOL
+	luaz_state_release(L);
+#else
 	lua_close(L);
-	memset(&self, 0, sizeof(self));
+#endif
+	/* Only the line: the heap stays registered for `lua_mem` and is reused next time */
+	memset(self.input_line, 0, sizeof(self.input_line));
 
 	return 0;
 }
@@ -0,0 +1,149 @@
+/**
+ * @file luaz_rom.c
+ * @brief Library tables served from flash.
+ *
+ * With CONFIG_LUA_ROM_LIBS a library is an empty table whose metatable
+ * __index is a C closure over the const luaL_Reg array: a lookup scans the
+ * array in flash and pushes the light C function it finds.  Nothing per
+ * function is allocated in the Lua heap, at the price of a C call and a
+ * short linear search per lookup; cache hot functions in locals.  __pairs
+ * walks the array, then the table's own fields.
+ *
+ * Method tables of userdata types stay ordinary tables either way: they
+ * are few, shared by all objects of a type, and on every message's path.
+ */
+
+#include "luaz_rom.h"
+
+#include <string.h>
+
+#ifdef CONFIG_LUA_ROM_LIBS
+
+/** @brief __index closure: look the key up in the luaL_Reg array of upvalue 1. */
+static int rom_index(lua_State *L)
+{
+	const luaL_Reg *reg = lua_touserdata(L, lua_upvalueindex(1));
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		const char *key = lua_tostring(L, 2);
+
+		for (; reg->name != NULL; reg++) {
+			if (strcmp(reg->name, key) == 0) {
+				lua_pushcfunction(L, reg->func);
+				return 1;
+			}
+		}
+	}
+
+	lua_pushnil(L);
+
+	return 1;
+}
+
+/** @brief Entry of @p reg named like the string at @p idx, or NULL. */
+static const luaL_Reg *rom_find(lua_State *L, const luaL_Reg *reg, int idx)
+{
+	if (lua_type(L, idx) != LUA_TSTRING) {
+		return NULL;
+	}
+
+	const char *key = lua_tostring(L, idx);
+
+	for (; reg->name != NULL; reg++) {
+		if (strcmp(reg->name, key) == 0) {
+			return reg;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief pairs() iterator: the luaL_Reg array of upvalue 1, then the raw
+ *        fields of table 1 that do not shadow an array entry.
+ */
+static int rom_next(lua_State *L)
+{
+	const luaL_Reg *funcs = lua_touserdata(L, lua_upvalueindex(1));
+	const luaL_Reg *reg = funcs;
+
+	lua_settop(L, 2);
+	if (!lua_isnil(L, 2)) {
+		reg = rom_find(L, funcs, 2);
+		if (reg == NULL) {
+			goto raw_fields;
+		}
+		reg++;
+	}
+
+	if (reg->name != NULL) {
+		lua_pushstring(L, reg->name);
+		if (lua_rawget(L, 1) == LUA_TNIL) {
+			lua_pop(L, 1);
+			lua_pushcfunction(L, reg->func);
+		}
+		lua_pushstring(L, reg->name);
+		lua_insert(L, -2);
+		return 2;
+	}
+
+	lua_pushnil(L);
+
+raw_fields:
+	while (lua_next(L, 1) != 0) {
+		if (rom_find(L, funcs, -2) == NULL) {
+			return 2;
+		}
+		lua_pop(L, 1);
+	}
+
+	return 0;
+}
+
+/** @brief __pairs closure: iterate with rom_next over the same array. */
+static int rom_pairs(lua_State *L)
+{
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_pushcclosure(L, rom_next, 1);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+
+	return 3;
+}
+
+void luaz_rom_newlib(lua_State *L, const luaL_Reg *funcs)
+{
+	lua_newtable(L);
+	lua_createtable(L, 0, 2);
+	lua_pushlightuserdata(L, (void *)funcs);
+	lua_pushcclosure(L, rom_index, 1);
+	lua_setfield(L, -2, "__index");
+	lua_pushlightuserdata(L, (void *)funcs);
+	lua_pushcclosure(L, rom_pairs, 1);
+	lua_setfield(L, -2, "__pairs");
+	lua_setmetatable(L, -2);
+}
+
+#else
+
+void luaz_rom_newlib(lua_State *L, const luaL_Reg *funcs)
+{
+	int n = 0;
+
+	while (funcs[n].name != NULL) {
+		n++;
+	}
+
+	lua_createtable(L, 0, n);
+	luaL_setfuncs(L, funcs, 0);
+}
+
+#endif /* CONFIG_LUA_ROM_LIBS */
+
+void luaz_rom_setmethods(lua_State *L, const luaL_Reg *funcs)
+{
+	/* metatable.__index = metatable */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	luaL_setfuncs(L, funcs, 0);
+}
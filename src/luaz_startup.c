@@ -0,0 +1,76 @@
+/**
+ * @file luaz_startup.c
+ * @brief Startup phase traces of generated Lua threads.
+ *
+ * The first instruction of a script is caught with a count hook of one
+ * instruction, installed right before its lua_pcall().  The hook finds its
+ * trace through the registry, stamps it and puts the previous hook back.
+ */
+
+#include "luaz_startup.h"
+
+#include <zephyr/sys/printk.h>
+
+/** @brief Registry key of the armed trace and the hook it replaced. */
+static const char armed_key;
+
+/** @brief Hook state saved by luaz_startup_arm(). */
+struct armed {
+	struct luaz_startup_trace *trace;
+	lua_Hook hook;
+	int mask;
+	int count;
+};
+
+static void first_insn_hook(lua_State *L, lua_Debug *ar)
+{
+	uint32_t now = k_cycle_get_32();
+
+	ARG_UNUSED(ar);
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &armed_key);
+	struct armed *armed = lua_touserdata(L, -1);
+
+	lua_pop(L, 1);
+	if (armed == NULL) {
+		lua_sethook(L, NULL, 0, 0);
+		return;
+	}
+
+	armed->trace->mark[LUAZ_STARTUP_FIRST_INSN] = now;
+	armed->trace->done = true;
+	lua_sethook(L, armed->hook, armed->mask, armed->count);
+
+	lua_pushnil(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &armed_key);
+}
+
+void luaz_startup_arm(lua_State *L, struct luaz_startup_trace *trace)
+{
+	struct armed *armed = lua_newuserdatauv(L, sizeof(*armed), 0);
+
+	armed->trace = trace;
+	armed->hook = lua_gethook(L);
+	armed->mask = lua_gethookmask(L);
+	armed->count = lua_gethookcount(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &armed_key);
+
+	lua_sethook(L, first_insn_hook, LUA_MASKCOUNT, 1);
+}
+
+void luaz_startup_print(const struct luaz_startup_trace *trace)
+{
+	const uint32_t *m = trace->mark;
+	uint32_t total = luaz_startup_total(trace);
+
+	printk("startup: name=%s flavour=%s entry=%u heap=%u newstate=%u openlibs=%u setup=%u "
+	       "load=%u pcall=%u total=%u us=%u\n",
+	       trace->name, trace->flavour, m[LUAZ_STARTUP_ENTRY],
+	       m[LUAZ_STARTUP_HEAP] - m[LUAZ_STARTUP_ENTRY],
+	       m[LUAZ_STARTUP_NEWSTATE] - m[LUAZ_STARTUP_HEAP],
+	       m[LUAZ_STARTUP_OPENLIBS] - m[LUAZ_STARTUP_NEWSTATE],
+	       m[LUAZ_STARTUP_SETUP] - m[LUAZ_STARTUP_OPENLIBS],
+	       m[LUAZ_STARTUP_LOAD] - m[LUAZ_STARTUP_SETUP],
+	       m[LUAZ_STARTUP_FIRST_INSN] - m[LUAZ_STARTUP_LOAD], total,
+	       k_cyc_to_us_floor32(total));
+}
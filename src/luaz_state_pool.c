@@ -0,0 +1,276 @@
+/**
+ * @file luaz_state_pool.c
+ * @brief Pool of ready-to-run Lua states for short-lived scripts.
+ *
+ * Each slot owns a luaz_heap and one Lua state.  After luaz_openlibs() and
+ * a require() of every preloaded library, shallow copies of the globals,
+ * package.loaded and the registry are kept in the registry as the slot's
+ * baseline; luaz_state_release() diffs the live tables against them and
+ * runs a full GC.
+ */
+
+#include "luaz_state_pool.h"
+
+#include <stdio.h>
+#include <lauxlib.h>
+#include <luaz_utils.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_DECLARE(lua_zephyr, CONFIG_LUA_ZEPHYR_LOG_LEVEL);
+
+/** @brief One pooled state and its heap. */
+struct pool_slot {
+	char mem[CONFIG_LUA_STATE_POOL_HEAP_SIZE];
+	struct luaz_heap heap;
+	/** Heap name shown by `lua_mem` (pool0, pool1, ...). */
+	char name[8];
+	/** NULL until created, or after a failed reset. */
+	lua_State *L;
+	bool in_use;
+};
+
+static struct pool_slot slots[CONFIG_LUA_STATE_POOL_SIZE];
+
+/** @brief Counts free slots. */
+static K_SEM_DEFINE(pool_sem, CONFIG_LUA_STATE_POOL_SIZE, CONFIG_LUA_STATE_POOL_SIZE);
+
+/** @brief Guards the in_use flags. */
+static struct k_spinlock pool_lock;
+
+/** @brief Registry key of the baseline table { globals, loaded, registry }. */
+static const char baseline_key;
+
+/** @brief Push a shallow copy of the table at @p idx. */
+static void snapshot(lua_State *L, int idx)
+{
+	idx = lua_absindex(L, idx);
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+}
+
+/**
+ * @brief Make the table at @p idx a shallow copy of the table at @p snap again.
+ *
+ * Fields are only cleared or overwritten while traversing the live table;
+ * missing ones are added back in a second pass over the snapshot.
+ */
+static void restore(lua_State *L, int idx, int snap)
+{
+	idx = lua_absindex(L, idx);
+	snap = lua_absindex(L, snap);
+
+	lua_pushnil(L);
+	while (lua_next(L, idx) != 0) {
+		lua_pushvalue(L, -2);
+		lua_rawget(L, snap);
+		if (!lua_rawequal(L, -1, -2)) {
+			lua_pushvalue(L, -3);
+			lua_insert(L, -2);
+			lua_rawset(L, idx);
+		} else {
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, snap) != 0) {
+		lua_pushvalue(L, -2);
+		if (lua_rawget(L, idx) == LUA_TNIL) {
+			lua_pop(L, 1);
+			lua_pushvalue(L, -2);
+			lua_insert(L, -2);
+			lua_rawset(L, idx);
+		} else {
+			lua_pop(L, 2);
+		}
+	}
+}
+
+/**
+ * @brief Require every library in package.preload, then record the baseline
+ *        of the state (protected).
+ *
+ * The libraries are part of the baseline, so acquire never pays their
+ * luaopen_*() and release keeps them in package.loaded.
+ */
+static int take_baseline(lua_State *L)
+{
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+	lua_pushnil(L);
+	while (lua_next(L, -2) != 0) {
+		lua_pop(L, 1);
+		lua_getglobal(L, "require");
+		lua_pushvalue(L, -2);
+		lua_call(L, 1, 0);
+	}
+	lua_pop(L, 1);
+
+	lua_createtable(L, 0, 3);
+
+	lua_pushglobaltable(L);
+	snapshot(L, -1);
+	lua_setfield(L, -3, "globals");
+	lua_pop(L, 1);
+
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+	snapshot(L, -1);
+	lua_setfield(L, -3, "loaded");
+	lua_pop(L, 1);
+
+	/* Stored first, so that the registry copy includes it */
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &baseline_key);
+	snapshot(L, LUA_REGISTRYINDEX);
+	lua_setfield(L, -2, "registry");
+
+	return 0;
+}
+
+/** @brief Restore a state to its baseline and collect the garbage (protected). */
+static int reset_to_baseline(lua_State *L)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &baseline_key);
+	int base = lua_gettop(L);
+
+	lua_pushglobaltable(L);
+	lua_getfield(L, base, "globals");
+	restore(L, -2, -1);
+	lua_pop(L, 2);
+
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+	lua_getfield(L, base, "loaded");
+	restore(L, -2, -1);
+	lua_pop(L, 2);
+
+	lua_getfield(L, base, "registry");
+	restore(L, LUA_REGISTRYINDEX, -1);
+	lua_settop(L, 0);
+
+	lua_gc(L, LUA_GCCOLLECT);
+
+	return 0;
+}
+
+/** @brief Apply the per-state settings a script may have changed. */
+static void configure(struct pool_slot *slot)
+{
+	luaz_gc_configure(slot->L, IS_ENABLED(CONFIG_LUA_GC_GENERATIONAL), CONFIG_LUA_GC_PAUSE,
+			  CONFIG_LUA_GC_STEPMUL, CONFIG_LUA_GC_STEPSIZE);
+#ifdef CONFIG_LUA_MEM_LIMIT
+	luaz_heap_set_limit(&slot->heap, 0);
+#endif
+}
+
+/** @brief Create the state of a slot; slot->L stays NULL on failure. */
+static void slot_open(struct pool_slot *slot)
+{
+	luaz_heap_init(&slot->heap, slot->name, slot->mem, sizeof(slot->mem));
+
+	lua_State *L = lua_newstate(lua_zephyr_allocator, &slot->heap, 0);
+
+	if (L == NULL) {
+		LOG_ERR("%s: cannot create Lua state", slot->name);
+		return;
+	}
+
+	luaz_openlibs(L);
+
+	lua_pushcfunction(L, take_baseline);
+	if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+		LOG_ERR("%s: %s", slot->name, lua_tostring(L, -1));
+		lua_close(L);
+		return;
+	}
+
+	slot->L = L;
+	configure(slot);
+}
+
+lua_State *luaz_state_acquire(k_timeout_t timeout)
+{
+	struct pool_slot *slot = NULL;
+
+	if (k_sem_take(&pool_sem, timeout) != 0) {
+		return NULL;
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&pool_lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (!slots[i].in_use) {
+			slot = &slots[i];
+			slot->in_use = true;
+			break;
+		}
+	}
+	k_spin_unlock(&pool_lock, key);
+
+	__ASSERT_NO_MSG(slot != NULL);
+
+	if (slot->L == NULL) {
+		slot_open(slot);
+		if (slot->L == NULL) {
+			key = k_spin_lock(&pool_lock);
+			slot->in_use = false;
+			k_spin_unlock(&pool_lock, key);
+			k_sem_give(&pool_sem);
+			return NULL;
+		}
+	}
+
+	return slot->L;
+}
+
+void luaz_state_release(lua_State *L)
+{
+	struct pool_slot *slot = NULL;
+
+	for (size_t i = 0; i < ARRAY_SIZE(slots); i++) {
+		if (slots[i].L == L) {
+			slot = &slots[i];
+			break;
+		}
+	}
+
+	__ASSERT(slot != NULL && slot->in_use, "state not acquired from the pool");
+
+	lua_sethook(L, NULL, 0, 0);
+	lua_settop(L, 0);
+	lua_pushcfunction(L, reset_to_baseline);
+	if (lua_pcall(L, 0, 0, 0) == LUA_OK) {
+		configure(slot);
+	} else {
+		LOG_WRN("%s: reset failed, recreating state", slot->name);
+		lua_close(L);
+		slot->L = NULL;
+		slot_open(slot);
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&pool_lock);
+
+	slot->in_use = false;
+	k_spin_unlock(&pool_lock, key);
+
+	k_sem_give(&pool_sem);
+}
+
+/** @brief Create the pooled states at boot. */
+static int luaz_state_pool_init(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(slots); i++) {
+		snprintf(slots[i].name, sizeof(slots[i].name), "pool%u", (unsigned int)i);
+		slot_open(&slots[i]);
+	}
+
+	return 0;
+}
+
+/* After lua_zbus_init(): opening zbus sizes its scratch buffer from the channels */
+SYS_INIT(luaz_state_pool_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY + 1);
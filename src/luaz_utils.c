@@ -1,9 +1,9 @@
 /**
  * @file luaz_utils.c
- * @brief Lua-Zephyr core: allocator, kernel API wrappers, and POSIX stubs.
+ * @brief Lua-Zephyr core: kernel API wrappers and POSIX stubs.
  *
- * Implements the sys_heap-backed Lua allocator and the `zephyr` Lua library
- * which exposes msleep, printk, and LOG_* to Lua scripts.
+ * Implements the `zephyr` Lua library which exposes msleep, uptime_ms,
+ * printk, and LOG_* to Lua scripts.  The allocator lives in luaz_heap.c.
  */
 
 #include "lua.h"
@@ -11,12 +11,13 @@
 
 #include <lauxlib.h>
 #include <lualib.h>
+#include <luaz_bundle.h>
+#include <luaz_rom.h>
 #ifdef CONFIG_LUA_LIB_ZBUS
 #include <luaz_zbus.h>
 #endif
 #include <sys/times.h>
 #include <time.h>
-#include <zephyr/sys/sys_heap.h>
 #include <zephyr/logging/log.h>
 
 #ifdef CONFIG_LUA_FS
@@ -25,84 +26,150 @@
 
 LOG_MODULE_REGISTER(lua_zephyr, CONFIG_LUA_ZEPHYR_LOG_LEVEL);
 
-/**
- * @brief The custom allocator that Lua will use to dynamically allocate all
-relevant data in the context
- *
- * @param ud User data, a reference to the custom heap region the allocator will
-use
- * @param ptr A pointer to the object that's going to be allocated/rellocated
- * @param osize The old size of the memory region that ptr points to
- * @param nsize The desired new size of the memory region that ptr points to
- */
-void *lua_zephyr_allocator(void *ud, void *ptr, size_t osize, size_t nsize)
+/** @brief Lua binding for k_msleep. Expects one integer argument (ms). */
+static int k_msleep_wrapper(lua_State *L)
 {
-	void *res = NULL;
+	int n = lua_gettop(L);
+	if (n != 1) {
+		return luaL_error(L, "expected 1 arguments, got %d", n);
+	}
 
-	if (nsize == 0) {
-		if (ptr != NULL) {
-			sys_heap_free(ud, ptr);
-		}
+	int ms = luaL_checkinteger(L, 1);
+	k_timepoint_t end = sys_timepoint_calc(K_MSEC(ms));
 
-	} else {
-		res = sys_heap_realloc(ud, ptr, nsize);
-		if (res == NULL) {
-			printk("Something went wrong with allocation\n");
-		}
-	}
+	luaz_heap_gc_check(L);
+	luaz_idle_gc(L, end);
+
+	k_sleep(sys_timepoint_timeout(end));
 
-	return res;
+	return 0;
 }
 
-/** @brief Print thread memory usage report (heap and stack) as a table. */
-void luaz_print_mem_usage(struct sys_heap *hp, size_t heap_size)
+/** @brief Lua binding for k_uptime_get. Returns the uptime in milliseconds. */
+static int k_uptime_ms_wrapper(lua_State *L)
 {
-	ARG_UNUSED(hp);
-	ARG_UNUSED(heap_size);
+	lua_pushinteger(L, k_uptime_get());
 
-	printk("-- Lua thread memory report:\n");
-	printk("       %6s  %8s  %8s  %5s\n", "size", "max used", "unused", "usage");
+	return 1;
+}
 
-#ifdef CONFIG_SYS_HEAP_RUNTIME_STATS
-	{
-		struct sys_memory_stats stats;
+void luaz_gc_configure(lua_State *L, bool generational, int pause, int stepmul, int stepsize)
+{
+	lua_gc(L, generational ? LUA_GCGEN : LUA_GCINC);
 
-		sys_heap_runtime_stats_get(hp, &stats);
-		printk("heap:  %6zu  %8zu  %8zu  %4u%%\n", heap_size, stats.max_allocated_bytes,
-		       stats.free_bytes,
-		       (unsigned int)(stats.max_allocated_bytes * 100U / heap_size));
+	if (pause > 0) {
+		lua_gc(L, LUA_GCPARAM, LUA_GCPPAUSE, pause);
+	}
+	if (stepmul > 0) {
+		lua_gc(L, LUA_GCPARAM, LUA_GCPSTEPMUL, stepmul);
+	}
+	if (stepsize > 0) {
+		lua_gc(L, LUA_GCPARAM, LUA_GCPSTEPSIZE, stepsize);
+	}
+}
+
+uint32_t luaz_gc_step_budget(lua_State *L, uint32_t budget_us, bool *done)
+{
+	uint32_t budget = k_us_to_cyc_ceil32(budget_us);
+	uint32_t start = k_cycle_get_32();
+	uint32_t steps = 0;
+	bool cycle_done = false;
+
+	while (!cycle_done && k_cycle_get_32() - start < budget) {
+		cycle_done = lua_gc(L, LUA_GCSTEP, 0);
+		steps++;
 	}
-#endif
 
-#if defined(CONFIG_INIT_STACKS) && defined(CONFIG_THREAD_STACK_INFO)
-	{
-		size_t unused;
-		const struct k_thread *t = k_current_get();
+	if (done != NULL) {
+		*done = cycle_done;
+	}
 
-		if (k_thread_stack_space_get(t, &unused) == 0) {
-			size_t size = t->stack_info.size;
-			size_t used = size - unused;
+	return steps;
+}
 
-			printk("stack: %6zu  %8zu  %8zu  %4u%%\n", size, used, unused,
-			       (unsigned int)(used * 100U / size));
+#ifdef CONFIG_LUA_IDLE_GC
+
+/** @brief Bytes of memory Lua currently uses, as collectgarbage("count"). */
+static size_t gc_count_bytes(lua_State *L)
+{
+	return (size_t)lua_gc(L, LUA_GCCOUNT) * 1024U + lua_gc(L, LUA_GCCOUNTB);
+}
+
+void luaz_idle_gc(lua_State *L, k_timepoint_t end)
+{
+	struct luaz_heap *h;
+	uint32_t budget_us = CONFIG_LUA_IDLE_GC_BUDGET_US;
+	k_timeout_t left = sys_timepoint_timeout(end);
+
+	lua_getallocf(L, (void **)&h);
+
+	if (!K_TIMEOUT_EQ(left, K_FOREVER)) {
+		uint64_t left_us = k_ticks_to_us_floor64(left.ticks);
+
+		if (left_us <= CONFIG_LUA_IDLE_GC_MIN_SLACK_US) {
+			return;
 		}
+		budget_us = MIN(budget_us, left_us - CONFIG_LUA_IDLE_GC_MIN_SLACK_US);
+	}
+
+	/* Nothing worth collecting since the last idle cycle */
+	if (gc_count_bytes(L) < h->idle_gc_base + CONFIG_LUA_IDLE_GC_MIN_GROWTH) {
+		return;
+	}
+
+	uint32_t start = k_cycle_get_32();
+	bool done;
+
+	h->idle_gc_steps += luaz_gc_step_budget(L, budget_us, &done);
+	h->idle_gc_us += k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+	if (done) {
+		h->idle_gc_cycles++;
+		h->idle_gc_base = gc_count_bytes(L);
 	}
-#endif
 }
 
-/** @brief Lua binding for k_msleep. Expects one integer argument (ms). */
-static int k_msleep_wrapper(lua_State *L)
+/**
+ * @brief Lua binding: zephyr.idle_gc_stats() -> steps, cycles, us.
+ *
+ * GC work the blocking bindings of this state moved into idle time.
+ */
+static int idle_gc_stats_wrapper(lua_State *L)
 {
-	int n = lua_gettop(L);
-	if (n != 1) {
-		return luaL_error(L, "expected 1 arguments, got %d", n);
-	}
+	struct luaz_heap *h;
 
-	int ms = luaL_checkinteger(L, 1);
+	lua_getallocf(L, (void **)&h);
 
-	k_msleep(ms);
+	lua_pushinteger(L, h->idle_gc_steps);
+	lua_pushinteger(L, h->idle_gc_cycles);
+	lua_pushinteger(L, h->idle_gc_us);
 
-	return 0;
+	return 3;
+}
+
+#endif /* CONFIG_LUA_IDLE_GC */
+
+/**
+ * @brief Lua binding: zephyr.gc_step_budget(us) -> done, steps.
+ *
+ * Runs GC steps for at most @p us microseconds; call it in idle time
+ * between zbus waits.
+ */
+static int gc_step_budget_wrapper(lua_State *L)
+{
+	lua_Integer us = luaL_checkinteger(L, 1);
+	bool done;
+
+	/* The budget is timed with the 32-bit cycle counter, which must not wrap */
+	luaL_argcheck(L, us > 0 && (lua_Unsigned)us <= k_cyc_to_us_floor32(UINT32_MAX), 1,
+		      "budget out of range");
+
+	uint32_t steps = luaz_gc_step_budget(L, (uint32_t)us, &done);
+
+	lua_pushboolean(L, done);
+	lua_pushinteger(L, steps);
+
+	return 2;
 }
 
 /** @brief Lua binding for printk. Expects one string argument. */
@@ -182,18 +249,32 @@ static int log_err_wrapper(lua_State *L)
 
 static const luaL_Reg zephyr_wrappers[] = {
 	{"msleep", k_msleep_wrapper},
+	{"uptime_ms", k_uptime_ms_wrapper},
+	{"gc_step_budget", gc_step_budget_wrapper},
+#ifdef CONFIG_LUA_IDLE_GC
+	{"idle_gc_stats", idle_gc_stats_wrapper},
+#endif
+#ifdef CONFIG_LUA_ALLOC_STATS
+	{"mem_stats", luaz_heap_mem_stats},
+#endif
+#ifdef CONFIG_LUA_MEM_LIMIT
+	{"mem_limit", luaz_heap_mem_limit},
+#endif
 	{"printk", printk_wrapper},
 	{"log_inf", log_inf_wrapper},
 	{"log_wrn", log_wrn_wrapper},
 	{"log_dbg", log_dbg_wrapper},
 	{"log_err", log_err_wrapper},
+#ifdef CONFIG_LUA_ZBUS_LISTEN
+	{"run", luaz_zbus_run},
+#endif
 	{NULL, NULL} /* Sentinel value to mark the end of the array */
 };
 
 /** @brief Open the `zephyr` Lua library. Registers kernel wrappers and nests zbus/fs. */
 int luaopen_zephyr(lua_State *L)
 {
-	luaL_newlib(L, zephyr_wrappers);
+	luaz_rom_newlib(L, zephyr_wrappers);
 
 #ifdef CONFIG_LUA_LIB_ZBUS
 	/* Nest zbus as zephyr.zbus */
@@ -210,16 +291,24 @@ int luaopen_zephyr(lua_State *L)
 	return 1;
 }
 
+#ifdef CONFIG_LUA_BUNDLE
+#define BUNDLE_NOT_FOUND "\n\tno module '%s' in the bundles"
+#else
+#define BUNDLE_NOT_FOUND ""
+#endif
+
 /**
  * @brief Minimal require() for preload-only environments.
  *
  * Checks registry._LOADED[name] first (cached), then falls back to
- * registry._PRELOAD[name].  No file/C-library searchers — eliminates
+ * registry._PRELOAD[name], then to the bundles linked with
+ * CONFIG_LUA_BUNDLE.  No file/C-library searchers — eliminates
  * ~1 KB heap overhead of luaopen_package() per Lua state.
  */
 static int luaz_require(lua_State *L)
 {
 	const char *name = luaL_checkstring(L, 1);
+	const char *where = ":preload:";
 
 	lua_settop(L, 1);
 
@@ -234,15 +323,25 @@ static int luaz_require(lua_State *L)
 	/* idx 3: _PRELOAD table */
 	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
 	if (lua_getfield(L, 3, name) == LUA_TNIL) {
-		return luaL_error(L,
-				  "module '%s' not found:\n\t"
-				  "no field package.preload['%s']",
-				  name, name);
+		lua_pop(L, 1);
+
+		int rc = luaz_bundle_load(L, name);
+
+		if (rc == -ENOENT) {
+			return luaL_error(L,
+					  "module '%s' not found:\n\t"
+					  "no field package.preload['%s']" BUNDLE_NOT_FOUND,
+					  name, name, name);
+		}
+		if (rc != LUA_OK) {
+			return lua_error(L);
+		}
+		where = ":bundle:";
 	}
 
-	/* call loader(name, ":preload:") */
+	/* call loader(name, where) */
 	lua_pushvalue(L, 1);
-	lua_pushliteral(L, ":preload:");
+	lua_pushstring(L, where);
 	lua_call(L, 2, 1);
 
 	if (!lua_isnil(L, -1)) {
@@ -254,7 +353,7 @@ static int luaz_require(lua_State *L)
 	}
 
 	lua_getfield(L, 2, name);
-	lua_pushliteral(L, ":preload:");
+	lua_pushstring(L, where);
 	return 2;
 }
 
@@ -3,8 +3,14 @@
  * @brief Lua bindings for Zephyr zbus: publish, read, wait, and serialization.
  *
  * Implements channel and observer userdata types with metatables so Lua scripts
- * can call :pub(), :read(), and :wait_msg().  Conversion between C structs and
- * Lua tables is handled via the descriptor system in lua_msg_descr.
+ * can call :pub(), :pub_many(), :read(), :read_into(), :view(), :with_claim(),
+ * :wait_msg(), :wait_msg_into() and :drain().  Conversion between C structs and Lua tables is handled
+ * via the descriptor system in lua_msg_descr; message views decode single
+ * fields on access through the same descriptors.
+ *
+ * With CONFIG_LUA_ZBUS_LISTEN, zbus.listen() attaches one shared C listener
+ * to channels and zephyr.run() dispatches the resulting notifications to
+ * Lua callbacks on the thread that owns the state.
  */
 
 #include <lauxlib.h>
@@ -15,6 +21,7 @@
 #include <luaz_utils.h>
 #include <luaz_zbus.h>
 #include <luaz_msg_descr.h>
+#include <luaz_rom.h>
 #include <zephyr/kernel.h>
 #include <zephyr/init.h>
 
@@ -22,40 +29,100 @@
 #define ZBUS_CHAN_METATABLE "zbus.channel.mt"
 /** @brief Metatable name for zbus observer userdata. */
 #define ZBUS_OBS_METATABLE  "zbus.observer.mt"
+/** @brief Metatable name for zbus message view userdata. */
+#define ZBUS_VIEW_METATABLE "zbus.view.mt"
+
+/**
+ * @brief Message view userdata: a raw message with lazy field access.
+ *
+ * A copy view (chan:view()) holds one message of @p chan in @p buf.  A claim
+ * view (chan:with_claim()) has no buffer; @p data points at the channel's
+ * own message while the claim is held and is NULL otherwise.  Fields are
+ * decoded or encoded one at a time by the __index/__newindex metamethods,
+ * using the channel descriptor.  User value 1 is the descriptor's
+ * field-name index.
+ */
+struct zbus_msg_view {
+	const struct zbus_channel *chan;
+	const struct lua_msg_descr *descr;
+	uint8_t *data;
+	/** Set by __newindex; tells with_claim() to notify observers. */
+	bool dirty;
+	uint8_t buf[];
+};
 
 /** @brief Largest message size across all registered zbus channels (computed at boot). */
 static size_t max_chan_msg_size;
 
 /**
- * @brief Allocate raw memory from the Lua state's heap allocator.
+ * @brief Registry key of the per-state message scratch buffer.
  *
- * @param L     Lua state whose allocator is used.
- * @param size  Number of bytes to allocate.
- * @return Pointer to allocated block, or NULL on failure.
+ * The address of this variable is used as a light userdata key into the
+ * Lua registry, where luaopen_zbus() anchors a struct zbus_scratch with
+ * max_chan_msg_size bytes of buffer.  The buffer lives as long as the Lua
+ * state and is released by lua_close() together with every other object.
  */
-static void *lua_alloc_raw(lua_State *L, size_t size)
-{
-	void *ud;
-	lua_Alloc allocf = lua_getallocf(L, &ud);
-
-	return allocf(ud, NULL, 0, size);
-}
+static const char zbus_scratch_key;
+
+/** @brief Message scratch buffer of a Lua state. */
+struct zbus_scratch {
+	/**
+	 * Set between zbus_scratch_acquire() and zbus_scratch_release().  A
+	 * Lua error raised in between (out of memory while converting) leaves
+	 * it set; later calls then use their own buffers, which is slower but
+	 * still correct.
+	 */
+	bool busy;
+	/** Message buffer, aligned for any message struct. */
+	uint8_t buf[] __aligned(8);
+};
 
 /**
- * @brief Free raw memory previously obtained from lua_alloc_raw().
+ * @brief Take the message scratch buffer of a Lua state.
+ *
+ * All channel and observer methods share one buffer, so pub/read/wait do
+ * not allocate in steady state.  Converting a message can run Lua code,
+ * such as a __gc finalizer during a GC step, and that code can call zbus
+ * again.  While the shared buffer is taken, such a nested call gets a new
+ * buffer instead of overwriting the half-converted message.
  *
- * @param L     Lua state whose allocator is used.
- * @param ptr   Pointer to the block to free.
- * @param size  Original allocation size (must match the alloc call).
+ * Pushes the buffer's userdata, which keeps it alive: leave it on the
+ * stack until zbus_scratch_release().
+ *
+ * @param L  Lua state.
+ * @return Scratch buffer of at least max_chan_msg_size bytes.
  */
-static void lua_free_raw(lua_State *L, void *ptr, size_t size)
+static struct zbus_scratch *zbus_scratch_acquire(lua_State *L)
 {
-	void *ud;
-	lua_Alloc allocf = lua_getallocf(L, &ud);
+	struct zbus_scratch *s;
+
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &zbus_scratch_key);
+	s = lua_touserdata(L, -1);
+	if (s->busy) {
+		lua_pop(L, 1);
+		s = lua_newuserdatauv(L, sizeof(*s) + max_chan_msg_size, 0);
+	}
+	s->busy = true;
 
-	allocf(ud, ptr, size, 0);
+	return s;
 }
 
+/** @brief Give back a buffer taken with zbus_scratch_acquire(). */
+static inline void zbus_scratch_release(struct zbus_scratch *s)
+{
+	s->busy = false;
+}
+
+/**
+ * @brief Registry key of the per-state channel userdata cache.
+ *
+ * Maps channel pointers (light userdata) to their channel userdata so that
+ * channel_declare() and wait_msg() hand out one userdata per channel
+ * instead of allocating a new one for every message.  The user value of a
+ * channel userdata holds its with_claim() view once created.
+ */
+static const char zbus_chan_cache_key;
+
 static bool find_max_msg_size(const struct zbus_channel *chan)
 {
 	size_t msg_size = zbus_chan_msg_size(chan);
@@ -82,6 +149,32 @@ static const struct zbus_channel **check_zbus_channel(lua_State *L, int idx)
 	return ud;
 }
 
+/**
+ * @brief Push the (cached) userdata for a zbus channel.
+ *
+ * @param L     Lua state.
+ * @param chan  Channel to wrap.
+ */
+static void push_zbus_channel(lua_State *L, const struct zbus_channel *chan)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &zbus_chan_cache_key);
+
+	if (lua_rawgetp(L, -1, chan) == LUA_TNIL) {
+		lua_pop(L, 1);
+
+		const struct zbus_channel **ud =
+			lua_newuserdata(L, sizeof(const struct zbus_channel *));
+		*ud = chan;
+		luaL_getmetatable(L, ZBUS_CHAN_METATABLE);
+		lua_setmetatable(L, -2);
+
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, -3, chan);
+	}
+
+	lua_remove(L, -2); /* pop cache table */
+}
+
 /**
  * @brief Convert a C message struct to a Lua table.
  *
@@ -104,6 +197,30 @@ static int msg_struct_to_lua_table(lua_State *L, const struct zbus_channel *chan
 	return 1;
 }
 
+/**
+ * @brief Convert a C message struct into an existing Lua table.
+ *
+ * Uses the descriptor stored in zbus_chan_user_data if available.
+ *
+ * @param L          Lua state.
+ * @param chan       The zbus channel the message belongs to.
+ * @param message    Pointer to the raw message buffer.
+ * @param table_idx  Absolute Lua stack index of the destination table.
+ * @return true if the table was filled, false if no descriptor is available.
+ */
+static bool msg_struct_fill_lua_table(lua_State *L, const struct zbus_channel *chan,
+				      void *message, int table_idx)
+{
+	const struct lua_msg_descr *descr = zbus_chan_user_data(chan);
+
+	if (descr == NULL) {
+		return false;
+	}
+
+	lua_msg_descr_fill_table(L, descr->fields, descr->field_count, message, table_idx);
+	return true;
+}
+
 /**
  * @brief Convert a Lua table to a C message struct.
  *
@@ -125,7 +242,11 @@ static size_t lua_table_to_msg_struct(lua_State *L, const struct zbus_channel *c
 	return 0;
 }
 
-/** @brief Lua method: channel:pub(table, timeout_ms) -> err. */
+/**
+ * @brief Lua method: channel:pub(table|view, timeout_ms) -> err.
+ *
+ * A view is published straight from its buffer, without any conversion.
+ */
 static int chan_pub(lua_State *L)
 {
 	int err = -EINVAL;
@@ -137,31 +258,164 @@ static int chan_pub(lua_State *L)
 
 	const struct zbus_channel **chan = check_zbus_channel(L, 1);
 
-	luaL_checktype(L, 2, LUA_TTABLE);
-
 	int timeout_ms = luaL_checkinteger(L, 3);
 
-	size_t msg_size = zbus_chan_msg_size(*chan);
-	void *msg = lua_alloc_raw(L, msg_size);
+	struct zbus_msg_view *view = luaL_testudata(L, 2, ZBUS_VIEW_METATABLE);
 
-	if (msg == NULL) {
-		lua_pushinteger(L, -ENOMEM);
+	if (view != NULL) {
+		luaL_argcheck(L, view->descr == zbus_chan_user_data(*chan), 2,
+			      "view of a channel with another message type");
+		luaL_argcheck(L, view->data != NULL, 2, "view used outside its claim");
+		err = zbus_chan_pub(*chan, view->data, K_MSEC(timeout_ms));
+		lua_pushinteger(L, err);
 		return 1;
 	}
 
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	struct zbus_scratch *scratch = zbus_scratch_acquire(L);
+	void *msg = scratch->buf;
+
+	/* Fields missing from the table are published as zero */
+	memset(msg, 0, zbus_chan_msg_size(*chan));
+
 	size_t s = lua_table_to_msg_struct(L, *chan, msg);
 
 	if (s) {
 		err = zbus_chan_pub(*chan, msg, K_MSEC(timeout_ms));
 	}
-
-	lua_free_raw(L, msg, msg_size);
+	zbus_scratch_release(scratch);
 
 	lua_pushinteger(L, err);
 
 	return 1;
 }
 
+/** @brief The view at @p idx if it is a live view of @p descr messages, else NULL. */
+static struct zbus_msg_view *is_view_of(lua_State *L, int idx, const struct lua_msg_descr *descr)
+{
+	struct zbus_msg_view *view = luaL_testudata(L, idx, ZBUS_VIEW_METATABLE);
+
+	if (view == NULL || view->descr != descr || view->data == NULL) {
+		return NULL;
+	}
+
+	return view;
+}
+
+/** @brief Message chan_pub_many() converts with pub_many_convert(). */
+struct pub_many_msg {
+	const struct lua_msg_descr *descr;
+	void *buf;
+	size_t size;
+};
+
+/**
+ * @brief Convert the table at index 2 into the message of the light
+ *        userdata at index 1; run with lua_pcall() by chan_pub_many().
+ */
+static int pub_many_convert(lua_State *L)
+{
+	struct pub_many_msg *m = lua_touserdata(L, 1);
+
+	/* Fields missing from the table are published as zero */
+	memset(m->buf, 0, m->size);
+	lua_msg_descr_from_table(L, m->descr->fields, m->descr->field_count, m->buf, 2);
+
+	return 0;
+}
+
+/**
+ * @brief Lua method: channel:pub_many(list, timeout_ms) -> count, err.
+ *
+ * Publishes every element of the sequence @p list (tables or views) in
+ * order.  Arguments, descriptor and scratch buffer are resolved once for
+ * the whole batch.  An element that is neither a table nor a view of this
+ * message type raises an error before anything is published.  Tables are
+ * converted in protected mode, so a conversion that fails (out of memory)
+ * stops the batch like a failed publish instead of raising.  Stops at the
+ * first failure so messages are never delivered out of order; @p count is
+ * the number published and @p err the error that stopped the batch (0 if
+ * all went out).
+ */
+static int chan_pub_many(lua_State *L)
+{
+	int n = lua_gettop(L);
+	if (n != 3) {
+		return luaL_error(L, "expected 3 arguments, got %d", n);
+	}
+
+	const struct zbus_channel **chan = check_zbus_channel(L, 1);
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	k_timeout_t timeout = K_MSEC(luaL_checkinteger(L, 3));
+	const struct lua_msg_descr *descr = zbus_chan_user_data(*chan);
+
+	if (descr == NULL) {
+		lua_pushinteger(L, 0);
+		lua_pushinteger(L, -EINVAL);
+		return 2;
+	}
+
+	size_t msg_size = zbus_chan_msg_size(*chan);
+	lua_Unsigned len = lua_rawlen(L, 2);
+	lua_Integer sent = 0;
+	int err = 0;
+
+	for (lua_Unsigned i = 1; i <= len; i++) {
+		if (lua_rawgeti(L, 2, (lua_Integer)i) != LUA_TTABLE &&
+		    !is_view_of(L, -1, descr)) {
+			return luaL_error(L, "element %d is not a table or a valid view of "
+					  "this message type", (int)i);
+		}
+		lua_pop(L, 1);
+	}
+
+	struct zbus_scratch *scratch = zbus_scratch_acquire(L);
+	struct pub_many_msg m = {.descr = descr, .buf = scratch->buf, .size = msg_size};
+
+	for (lua_Unsigned i = 1; i <= len; i++) {
+		if (lua_rawgeti(L, 2, (lua_Integer)i) == LUA_TTABLE) {
+			lua_pushcfunction(L, pub_many_convert);
+			lua_pushlightuserdata(L, &m);
+			lua_pushvalue(L, -3);
+
+			int status = lua_pcall(L, 2, 0, 0);
+
+			if (status != LUA_OK) {
+				lua_pop(L, 2);
+				err = status == LUA_ERRMEM ? -ENOMEM : -EINVAL;
+				break;
+			}
+			err = zbus_chan_pub(*chan, m.buf, timeout);
+		} else {
+			struct zbus_msg_view *view = is_view_of(L, -1, descr);
+
+			/* Checked above; fails only if a finalizer changed the list */
+			if (view == NULL) {
+				lua_pop(L, 1);
+				err = -EINVAL;
+				break;
+			}
+			err = zbus_chan_pub(*chan, view->data, timeout);
+		}
+
+		lua_pop(L, 1);
+
+		if (err) {
+			break;
+		}
+		sent++;
+	}
+	zbus_scratch_release(scratch);
+
+	lua_pushinteger(L, sent);
+	lua_pushinteger(L, err);
+
+	return 2;
+}
+
 /** @brief Lua method: channel:read(timeout_ms) -> err, table. */
 static int chan_read(lua_State *L)
 {
@@ -175,25 +429,282 @@ static int chan_read(lua_State *L)
 	const struct zbus_channel **chan = check_zbus_channel(L, 1);
 	int timeout_ms = luaL_checkinteger(L, 2);
 
-	size_t msg_size = zbus_chan_msg_size(*chan);
-	void *msg = lua_alloc_raw(L, msg_size);
+	struct zbus_scratch *scratch = zbus_scratch_acquire(L);
+	void *msg = scratch->buf;
+
+	err = zbus_chan_read(*chan, msg, K_MSEC(timeout_ms));
+
+	lua_pushinteger(L, err);
+
+	msg_struct_to_lua_table(L, *chan, msg);
+	zbus_scratch_release(scratch);
 
-	if (msg == NULL) {
-		lua_pushinteger(L, -ENOMEM);
+	return 2;
+}
+
+/**
+ * @brief Lua method: channel:read_into(table, timeout_ms) -> err, table.
+ *
+ * Like read(), but refills a caller-owned table (including nested
+ * subtables) instead of creating a new one.  The table is left untouched
+ * when the read fails.
+ */
+static int chan_read_into(lua_State *L)
+{
+	int n = lua_gettop(L);
+	if (n != 3) {
+		return luaL_error(L, "expected 3 arguments, got %d", n);
+	}
+
+	const struct zbus_channel **chan = check_zbus_channel(L, 1);
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	int timeout_ms = luaL_checkinteger(L, 3);
+
+	struct zbus_scratch *scratch = zbus_scratch_acquire(L);
+	void *msg = scratch->buf;
+
+	int err = zbus_chan_read(*chan, msg, K_MSEC(timeout_ms));
+
+	if (err == 0 && !msg_struct_fill_lua_table(L, *chan, msg, 2)) {
+		err = -EINVAL;
+	}
+	zbus_scratch_release(scratch);
+
+	lua_pushinteger(L, err);
+	lua_pushvalue(L, 2);
+
+	return 2;
+}
+/** @brief Validate and return the zbus message view userdata at stack index @p idx. */
+static struct zbus_msg_view *check_zbus_view(lua_State *L, int idx)
+{
+	return luaL_checkudata(L, idx, ZBUS_VIEW_METATABLE);
+}
+
+/**
+ * @brief Push a new message view for a channel.
+ *
+ * @param L      Lua state.
+ * @param chan   Channel the view reads from.
+ * @param descr  Message descriptor of @p chan.
+ * @param copy   true for a copy view with a zeroed buffer of the channel's
+ *               message size, false for a (not yet claimed) claim view.
+ * @return The view (left on top of the stack).
+ */
+static struct zbus_msg_view *push_zbus_view(lua_State *L, const struct zbus_channel *chan,
+					    const struct lua_msg_descr *descr, bool copy)
+{
+	size_t buf_size = copy ? zbus_chan_msg_size(chan) : 0;
+	struct zbus_msg_view *view = lua_newuserdatauv(L, sizeof(*view) + buf_size, 1);
+
+	view->chan = chan;
+	view->descr = descr;
+	view->data = copy ? view->buf : NULL;
+	view->dirty = false;
+	memset(view->buf, 0, buf_size);
+
+	luaL_getmetatable(L, ZBUS_VIEW_METATABLE);
+	lua_setmetatable(L, -2);
+
+	lua_msg_descr_push_field_index(L, descr->fields, descr->field_count);
+	lua_setiuservalue(L, -2, 1);
+
+	return view;
+}
+
+/**
+ * @brief Resolve the field named by the key at stack index 2 of a view method.
+ *
+ * Raises a Lua error if the view is a claim view used outside its claim.
+ *
+ * @return Field descriptor, or NULL if the message has no such field.
+ */
+static const struct lua_msg_field_descr *view_field(lua_State *L, struct zbus_msg_view *view)
+{
+	if (view->data == NULL) {
+		luaL_error(L, "zbus view used outside its claim");
+	}
+
+	lua_getiuservalue(L, 1, 1);
+	lua_pushvalue(L, 2);
+	lua_rawget(L, -2);
+
+	lua_Integer i = lua_tointeger(L, -1);
+
+	lua_pop(L, 2);
+
+	return i > 0 ? &view->descr->fields[i - 1] : NULL;
+}
+
+/**
+ * @brief Lua method: channel:view(timeout_ms [, view]) -> err, view.
+ *
+ * Copies the current message into a view instead of decoding it into a
+ * table.  Passing a view previously returned for this channel refills it,
+ * so steady-state use does not allocate.
+ */
+static int chan_view(lua_State *L)
+{
+	int n = lua_gettop(L);
+	if (n != 2 && n != 3) {
+		return luaL_error(L, "expected 2 or 3 arguments, got %d", n);
+	}
+
+	const struct zbus_channel **chan = check_zbus_channel(L, 1);
+	int timeout_ms = luaL_checkinteger(L, 2);
+	const struct lua_msg_descr *descr = zbus_chan_user_data(*chan);
+	struct zbus_msg_view *view;
+
+	if (descr == NULL) {
+		lua_pushinteger(L, -EINVAL);
 		lua_pushnil(L);
 		return 2;
 	}
 
-	err = zbus_chan_read(*chan, msg, K_MSEC(timeout_ms));
+	if (lua_isnoneornil(L, 3)) {
+		view = push_zbus_view(L, *chan, descr, true);
+	} else {
+		view = check_zbus_view(L, 3);
+		luaL_argcheck(L, view->chan == *chan, 3, "view of another channel");
+		luaL_argcheck(L, view->data == view->buf, 3, "claim views cannot be refilled");
+		lua_pushvalue(L, 3);
+	}
+
+	int err = zbus_chan_read(*chan, view->data, K_MSEC(timeout_ms));
 
 	lua_pushinteger(L, err);
+	lua_insert(L, -2);
 
-	msg_struct_to_lua_table(L, *chan, msg);
+	return 2;
+}
 
-	lua_free_raw(L, msg, msg_size);
+/**
+ * @brief Lua method: channel:with_claim(timeout_ms, fn) -> err, ...
+ *
+ * Claims the channel and calls fn(view) with a view on the channel's own
+ * message memory, so nothing is copied.  The view is invalidated and the
+ * claim released as soon as fn returns, also when fn raises an error,
+ * which is then propagated.  If fn assigned any field, observers are
+ * notified after the claim is released.  fn must not block or touch the
+ * same channel through pub/read, as the channel lock is held meanwhile.
+ *
+ * @return err (claim or notify result) followed by fn's return values;
+ *         fn is not called when the claim fails.
+ */
+static int chan_with_claim(lua_State *L)
+{
+	int n = lua_gettop(L);
+	if (n != 3) {
+		return luaL_error(L, "expected 3 arguments, got %d", n);
+	}
 
-	return 2;
+	const struct zbus_channel **chan = check_zbus_channel(L, 1);
+	int timeout_ms = luaL_checkinteger(L, 2);
+
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+
+	const struct lua_msg_descr *descr = zbus_chan_user_data(*chan);
+
+	if (descr == NULL) {
+		lua_pushinteger(L, -EINVAL);
+		return 1;
+	}
+
+	/*
+	 * The claim view is kept as the channel userdata's user value and
+	 * reused; it is created before claiming, so a memory error cannot
+	 * leak the claim.
+	 */
+	struct zbus_msg_view *view;
+
+	if (lua_getiuservalue(L, 1, 1) == LUA_TUSERDATA) {
+		view = lua_touserdata(L, -1);
+	} else {
+		lua_pop(L, 1);
+		view = push_zbus_view(L, *chan, descr, false);
+		lua_pushvalue(L, -1);
+		lua_setiuservalue(L, 1, 1);
+	}
+
+	int err = zbus_chan_claim(*chan, K_MSEC(timeout_ms));
+
+	if (err) {
+		lua_pushinteger(L, err);
+		return 1;
+	}
+
+	view->data = zbus_chan_msg(*chan);
+	view->dirty = false;
+
+	lua_pushvalue(L, 3);
+	lua_pushvalue(L, 4);
+
+	int status = lua_pcall(L, 1, LUA_MULTRET, 0);
+
+	view->data = NULL;
+	zbus_chan_finish(*chan);
+
+	if (status != LUA_OK) {
+		return lua_error(L);
+	}
+
+	if (view->dirty) {
+		err = zbus_chan_notify(*chan, K_MSEC(timeout_ms));
+	}
+
+	lua_pushinteger(L, err);
+	lua_replace(L, 4); /* view slot becomes err, followed by the results */
+
+	return lua_gettop(L) - 3;
+}
+
+/** @brief Lua metamethod __index: decode one field of a view. */
+static int view_index(lua_State *L)
+{
+	struct zbus_msg_view *view = check_zbus_view(L, 1);
+	const struct lua_msg_field_descr *f = view_field(L, view);
+
+	if (f == NULL) {
+		lua_pushnil(L);
+	} else {
+		lua_msg_descr_push_field(L, f, view->data);
+	}
+
+	return 1;
+}
+
+/** @brief Lua metamethod __newindex: encode one field of a view. */
+static int view_newindex(lua_State *L)
+{
+	struct zbus_msg_view *view = check_zbus_view(L, 1);
+	const struct lua_msg_field_descr *f = view_field(L, view);
+
+	if (f == NULL) {
+		return luaL_error(L, "zbus view has no field '%s'", lua_tostring(L, 2));
+	}
+
+	lua_msg_descr_store_field(L, f, view->data, 3);
+	view->dirty = true;
+
+	return 0;
 }
+
+/** @brief Lua metamethod __tostring: return a human-readable view string. */
+static int view_tostring(lua_State *L)
+{
+	struct zbus_msg_view *view = check_zbus_view(L, 1);
+
+	lua_pushfstring(L, "zbus_view { chan=%s }", zbus_chan_name(view->chan));
+	return 1;
+}
+
+static const struct luaL_Reg zbus_view_metamethods[] = {{"__index", view_index},
+							{"__newindex", view_newindex},
+							{"__tostring", view_tostring},
+							{NULL, NULL}};
+
 /** @brief Lua metamethod __eq: compare two channel userdata by pointer. */
 static int chan_equals(lua_State *L)
 {
@@ -225,7 +736,11 @@ static int chan_tostring(lua_State *L)
 }
 
 static const struct luaL_Reg zbus_chan_metamethods[] = {{"pub", chan_pub},
+							{"pub_many", chan_pub_many},
 							{"read", chan_read},
+							{"read_into", chan_read_into},
+							{"view", chan_view},
+							{"with_claim", chan_with_claim},
 							{"__tostring", chan_tostring},
 							{"__eq", chan_equals},
 							{NULL, NULL}};
@@ -238,6 +753,33 @@ static const struct zbus_observer **check_zbus_observer(lua_State *L, int idx)
 	return ud;
 }
 
+/**
+ * @brief Wait for a message on a subscriber, doing the state's GC work first.
+ *
+ * Drives the GC under memory pressure (luaz_heap_gc_check()).  With
+ * CONFIG_LUA_IDLE_GC, when no message is pending yet, GC steps run in the
+ * time the wait would otherwise block (luaz_idle_gc()).
+ */
+static int sub_wait(lua_State *L, const struct zbus_observer *obs,
+		    const struct zbus_channel **chan, void *msg, int timeout_ms)
+{
+	k_timepoint_t end = sys_timepoint_calc(K_MSEC(timeout_ms));
+
+	luaz_heap_gc_check(L);
+
+#ifdef CONFIG_LUA_IDLE_GC
+	int err = zbus_sub_wait_msg(obs, chan, msg, K_NO_WAIT);
+
+	if (err != -ENOMSG) {
+		return err;
+	}
+
+	luaz_idle_gc(L, end);
+#endif
+
+	return zbus_sub_wait_msg(obs, chan, msg, sys_timepoint_timeout(end));
+}
+
 /** @brief Lua method: observer:wait_msg(timeout_ms) -> err, channel, table. */
 static int sub_wait_msg(lua_State *L)
 {
@@ -246,40 +788,479 @@ static int sub_wait_msg(lua_State *L)
 	const struct zbus_observer **obs = check_zbus_observer(L, 1);
 	int timeout_ms = luaL_checkinteger(L, 2);
 
-	void *msg = lua_alloc_raw(L, max_chan_msg_size);
+	struct zbus_scratch *scratch = zbus_scratch_acquire(L);
+	void *msg = scratch->buf;
+
+	int err = sub_wait(L, *obs, &chan, msg, timeout_ms);
 
-	if (msg == NULL) {
-		lua_pushinteger(L, -ENOMEM);
+	lua_pushinteger(L, err);
+
+	if (err) {
 		lua_pushnil(L);
 		lua_pushnil(L);
-		return 3;
+	} else {
+		push_zbus_channel(L, chan);
+		msg_struct_to_lua_table(L, chan, msg);
 	}
+	zbus_scratch_release(scratch);
 
-	int err = zbus_sub_wait_msg(*obs, &chan, msg, K_MSEC(timeout_ms));
+	return 3;
+}
+
+/**
+ * @brief Lua method: observer:wait_msg_into(table, timeout_ms) -> err, channel, table.
+ *
+ * Like wait_msg(), but refills a caller-owned table (including nested
+ * subtables) instead of creating a new one.  The channel userdata is
+ * cached per channel, so a steady-state consumer loop does not allocate.
+ * The table is left untouched when the wait fails.
+ */
+static int sub_wait_msg_into(lua_State *L)
+{
+	const struct zbus_channel *chan;
+
+	const struct zbus_observer **obs = check_zbus_observer(L, 1);
+
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	int timeout_ms = luaL_checkinteger(L, 3);
+
+	struct zbus_scratch *scratch = zbus_scratch_acquire(L);
+	void *msg = scratch->buf;
+
+	int err = sub_wait(L, *obs, &chan, msg, timeout_ms);
+
+	if (err == 0 && !msg_struct_fill_lua_table(L, chan, msg, 2)) {
+		err = -EINVAL;
+	}
+	zbus_scratch_release(scratch);
 
 	lua_pushinteger(L, err);
 
 	if (err) {
 		lua_pushnil(L);
-		lua_pushnil(L);
 	} else {
-		const struct zbus_channel **lua_chan =
-			lua_newuserdata(L, sizeof(const struct zbus_channel *));
-		*lua_chan = chan;
-		luaL_getmetatable(L, ZBUS_CHAN_METATABLE);
-		lua_setmetatable(L, -2);
+		push_zbus_channel(L, chan);
+	}
+	lua_pushvalue(L, 2);
 
-		msg_struct_to_lua_table(L, chan, msg);
+	return 3;
+}
+
+/**
+ * @brief Store one drained message as entry @p n of the batch at @p batch_idx.
+ *
+ * Entry tables, and their msg table when the entry held a message of the
+ * same channel before, are reused, so draining into the same batch again
+ * does not allocate.
+ */
+static void drain_store(lua_State *L, int batch_idx, lua_Integer n,
+			const struct zbus_channel *chan, void *message)
+{
+	if (lua_rawgeti(L, batch_idx, n) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_createtable(L, 0, 2);
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, batch_idx, n);
 	}
 
-	lua_free_raw(L, msg, max_chan_msg_size);
+	int entry = lua_gettop(L);
+
+	push_zbus_channel(L, chan);
+	lua_getfield(L, entry, "chan");
+
+	bool same_chan = lua_rawequal(L, -1, -2);
+
+	lua_pop(L, 1);
+	lua_setfield(L, entry, "chan");
+
+	if (same_chan && lua_getfield(L, entry, "msg") == LUA_TTABLE &&
+	    msg_struct_fill_lua_table(L, chan, message, lua_gettop(L))) {
+		lua_pop(L, 2);
+		return;
+	}
+
+	if (same_chan) {
+		lua_pop(L, 1);
+	}
+
+	msg_struct_to_lua_table(L, chan, message);
+	lua_setfield(L, entry, "msg");
+	lua_pop(L, 1);
+}
+
+/**
+ * @brief Lua method: observer:drain(max_n, first_timeout_ms [, batch]) -> err, n, batch.
+ *
+ * Waits up to @p first_timeout_ms for one message, then takes whatever is
+ * already queued without waiting, up to @p max_n messages in total.  Entry
+ * i of the batch is a table { chan = channel, msg = table }.  Passing the
+ * previous batch back reuses its entry and message tables; entries past
+ * @p n are left in place for later reuse and must be ignored.
+ *
+ * @return err of the first wait (0 once at least one message was drained),
+ *         the number of messages n and the batch.
+ */
+static int sub_drain(lua_State *L)
+{
+	const struct zbus_channel *chan;
+
+	const struct zbus_observer **obs = check_zbus_observer(L, 1);
+	lua_Integer max_n = luaL_checkinteger(L, 2);
+	int timeout_ms = luaL_checkinteger(L, 3);
+
+	luaL_argcheck(L, max_n > 0, 2, "must be positive");
+
+	if (lua_isnoneornil(L, 4)) {
+		lua_settop(L, 3);
+		lua_createtable(L, (int)MIN(max_n, 32), 0);
+	} else {
+		luaL_checktype(L, 4, LUA_TTABLE);
+		lua_settop(L, 4);
+	}
+
+	struct zbus_scratch *scratch = zbus_scratch_acquire(L);
+	void *msg = scratch->buf;
+	lua_Integer n = 0;
+
+	int err = sub_wait(L, *obs, &chan, msg, timeout_ms);
+
+	while (err == 0) {
+		drain_store(L, 4, ++n, chan, msg);
+		if (n == max_n) {
+			break;
+		}
+		err = zbus_sub_wait_msg(*obs, &chan, msg, K_NO_WAIT);
+	}
+	zbus_scratch_release(scratch);
+
+	lua_pushinteger(L, n > 0 ? 0 : err);
+	lua_pushinteger(L, n);
+	lua_pushvalue(L, 4);
 
 	return 3;
 }
 
-static const struct luaL_Reg zbus_obs_metamethods[] = {{"wait_msg", sub_wait_msg}, {NULL, NULL}};
+static const struct luaL_Reg zbus_obs_metamethods[] = {{"wait_msg", sub_wait_msg},
+						       {"wait_msg_into", sub_wait_msg_into},
+						       {"drain", sub_drain},
+						       {NULL, NULL}};
+
+#ifdef CONFIG_LUA_ZBUS_LISTEN
+
+/** @brief Metatable name for the per-state event loop userdata. */
+#define ZBUS_LOOP_METATABLE "zbus.loop.mt"
+
+/**
+ * @brief Per-state event loop (Lua full userdata).
+ *
+ * The shared listener sets the bit of every listen slot notified for a
+ * channel and gives the semaphore; zephyr.run() takes it and dispatches
+ * the pending slots.  Notifications of one slot coalesce until dispatched,
+ * so nothing can overflow.  User value 1 maps slot + 1 to the Lua entry
+ * {fn, channel, msg}.
+ */
+struct zbus_loop {
+	struct k_sem sem;
+	ATOMIC_DEFINE(pending, CONFIG_LUA_ZBUS_LISTEN_MAX);
+};
+
+/** @brief One zbus.listen() registration, shared by all Lua states. */
+struct zbus_listen_slot {
+	const struct zbus_channel *chan;
+	struct zbus_loop *loop;
+};
+
+static struct zbus_listen_slot listen_slots[CONFIG_LUA_ZBUS_LISTEN_MAX];
+
+/**
+ * @brief Guards listen_slots against the listener callback.
+ *
+ * Also keeps a loop from being freed by loop_gc() while a publisher flags
+ * it, which is why the callback is not lock-free.
+ */
+static struct k_spinlock listen_lock;
+
+/** @brief Serializes slot (de)allocation with observer (de)registration. */
+static K_MUTEX_DEFINE(listen_mutex);
 
-/** @brief Lua function: zbus.channel_declare(name) -> channel userdata. */
+/** @brief Registry key of the per-state event loop. */
+static const char zbus_loop_key;
+
+/**
+ * @brief Listener callback: flag every Lua loop listening on @p chan.
+ *
+ * Runs in the publisher's context, and scans every listen slot with
+ * listen_lock held.
+ */
+static void luaz_zbus_listener_cb(const struct zbus_channel *chan)
+{
+	k_spinlock_key_t key = k_spin_lock(&listen_lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(listen_slots); i++) {
+		if (listen_slots[i].chan == chan) {
+			atomic_set_bit(listen_slots[i].loop->pending, i);
+			k_sem_give(&listen_slots[i].loop->sem);
+		}
+	}
+
+	k_spin_unlock(&listen_lock, key);
+}
+
+ZBUS_LISTENER_DEFINE(luaz_zbus_listener, luaz_zbus_listener_cb);
+
+/**
+ * @brief Lua metamethod __gc of the event loop: drop its listen slots.
+ *
+ * Runs at lua_close().  The listener is detached from channels no other
+ * loop listens on anymore.
+ */
+static int loop_gc(lua_State *L)
+{
+	struct zbus_loop *loop = luaL_checkudata(L, 1, ZBUS_LOOP_METATABLE);
+	const struct zbus_channel *freed[CONFIG_LUA_ZBUS_LISTEN_MAX];
+	size_t n_freed = 0;
+
+	k_mutex_lock(&listen_mutex, K_FOREVER);
+
+	k_spinlock_key_t key = k_spin_lock(&listen_lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(listen_slots); i++) {
+		if (listen_slots[i].loop == loop) {
+			freed[n_freed++] = listen_slots[i].chan;
+			listen_slots[i] = (struct zbus_listen_slot){0};
+		}
+	}
+
+	k_spin_unlock(&listen_lock, key);
+
+	for (size_t j = 0; j < n_freed; j++) {
+		bool in_use = false;
+
+		for (size_t i = 0; i < ARRAY_SIZE(listen_slots); i++) {
+			in_use |= listen_slots[i].chan == freed[j];
+		}
+		if (!in_use) {
+			/* -ENODEV when already removed for a duplicate entry */
+			(void)zbus_chan_rm_obs(freed[j], &luaz_zbus_listener, K_FOREVER);
+		}
+	}
+
+	k_mutex_unlock(&listen_mutex);
+
+	return 0;
+}
+
+/**
+ * @brief Get the event loop of a Lua state.
+ *
+ * @param L       Lua state.
+ * @param create  Create the loop if the state has none yet.
+ * @return The loop (its userdata pushed), or NULL (nil pushed).
+ */
+static struct zbus_loop *push_zbus_loop(lua_State *L, bool create)
+{
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &zbus_loop_key) == LUA_TUSERDATA || !create) {
+		return lua_touserdata(L, -1);
+	}
+	lua_pop(L, 1);
+
+	struct zbus_loop *loop = lua_newuserdatauv(L, sizeof(*loop), 1);
+
+	k_sem_init(&loop->sem, 0, K_SEM_MAX_LIMIT);
+	memset(loop->pending, 0, sizeof(loop->pending));
+
+	luaL_setmetatable(L, ZBUS_LOOP_METATABLE);
+
+	lua_newtable(L);
+	lua_setiuservalue(L, -2, 1);
+
+	lua_pushvalue(L, -1);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &zbus_loop_key);
+
+	return loop;
+}
+
+/**
+ * @brief Lua function: zbus.listen(channel, fn) -> err.
+ *
+ * Calls fn(channel, msg) from zephyr.run() whenever @p channel is
+ * published.  Publishing only flags the registration (no message copy);
+ * msg is read when the callback runs, so several publications between two
+ * dispatches are seen once, with the latest message.  msg is the same
+ * table on every call and nil if the channel has no descriptor.
+ *
+ * @return 0, or -ENOMEM when all CONFIG_LUA_ZBUS_LISTEN_MAX slots are in use
+ *         or the error of attaching the listener to the channel.
+ */
+static int zbus_listen(lua_State *L)
+{
+	const struct zbus_channel **chan = check_zbus_channel(L, 1);
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_settop(L, 2);
+
+	struct zbus_loop *loop = push_zbus_loop(L, true);
+
+	/* Lua entry {fn, channel, msg}; built first so errors cannot leak a slot */
+	lua_getiuservalue(L, 3, 1);
+	lua_createtable(L, 3, 0);
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 1);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, 2);
+	if (zbus_chan_user_data(*chan) != NULL) {
+		lua_newtable(L);
+		lua_rawseti(L, -2, 3);
+	}
+
+	int slot = -1;
+	int err = -ENOMEM;
+
+	k_mutex_lock(&listen_mutex, K_FOREVER);
+
+	for (size_t i = 0; i < ARRAY_SIZE(listen_slots); i++) {
+		if (listen_slots[i].chan == NULL) {
+			slot = i;
+			break;
+		}
+	}
+
+	if (slot >= 0) {
+		err = zbus_chan_add_obs(*chan, &luaz_zbus_listener, K_FOREVER);
+		if (err == -EEXIST) {
+			err = 0;
+		}
+	}
+
+	if (err == 0) {
+		/* The entry must be in place before the first notification */
+		lua_rawseti(L, -2, slot + 1);
+
+		k_spinlock_key_t key = k_spin_lock(&listen_lock);
+
+		listen_slots[slot] = (struct zbus_listen_slot){.chan = *chan, .loop = loop};
+		k_spin_unlock(&listen_lock, key);
+	}
+
+	k_mutex_unlock(&listen_mutex);
+
+	lua_pushinteger(L, err);
+
+	return 1;
+}
+
+/**
+ * @brief Wait for listen notifications of a loop, doing the state's GC work first.
+ *
+ * Like sub_wait(): GC under memory pressure, then idle-time GC steps when
+ * nothing is pending yet (CONFIG_LUA_IDLE_GC).
+ */
+static int loop_wait(lua_State *L, struct zbus_loop *loop, k_timepoint_t end)
+{
+	luaz_heap_gc_check(L);
+
+	if (IS_ENABLED(CONFIG_LUA_IDLE_GC) && k_sem_count_get(&loop->sem) == 0) {
+		luaz_idle_gc(L, end);
+	}
+
+	return k_sem_take(&loop->sem, sys_timepoint_timeout(end));
+}
+
+/** @brief Whether any listen slot of @p loop is pending. */
+static bool loop_pending(struct zbus_loop *loop)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(loop->pending); i++) {
+		if (atomic_get(&loop->pending[i]) != 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Lua function: zephyr.run([timeout_ms]) -> dispatched.
+ *
+ * Event loop of the calling Lua state: waits for zbus.listen()
+ * notifications and dispatches every pending callback in one batch per
+ * wake-up, until @p timeout_ms has elapsed (forever when omitted; 0
+ * dispatches what is pending and returns).  Errors raised by callbacks
+ * propagate out of run(); the slots not dispatched yet stay pending for
+ * the next run().
+ *
+ * @return Number of callbacks dispatched.
+ */
+int luaz_zbus_run(lua_State *L)
+{
+	lua_Integer timeout_ms = luaL_optinteger(L, 1, -1);
+	k_timepoint_t end = sys_timepoint_calc(timeout_ms < 0 ? K_FOREVER : K_MSEC(timeout_ms));
+	lua_Integer dispatched = 0;
+
+	lua_settop(L, 0);
+
+	struct zbus_loop *loop = push_zbus_loop(L, false);
+
+	if (loop == NULL) {
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	lua_getiuservalue(L, 1, 1);
+
+	while (loop_wait(L, loop, end) == 0) {
+		/* Later notifications set their bit before giving the semaphore */
+		k_sem_reset(&loop->sem);
+
+		for (size_t i = 0; i < CONFIG_LUA_ZBUS_LISTEN_MAX; i++) {
+			if (!atomic_test_and_clear_bit(loop->pending, i) ||
+			    lua_rawgeti(L, 2, i + 1) != LUA_TTABLE) {
+				lua_settop(L, 2);
+				continue;
+			}
+
+			lua_rawgeti(L, 3, 1);
+			lua_rawgeti(L, 3, 2);
+
+			const struct zbus_channel **chan = lua_touserdata(L, -1);
+
+			if (lua_rawgeti(L, 3, 3) == LUA_TTABLE) {
+				int msg_idx = lua_gettop(L);
+				/* Taken per message: the callback may publish or read itself */
+				struct zbus_scratch *scratch = zbus_scratch_acquire(L);
+
+				if (zbus_chan_read(*chan, scratch->buf, K_FOREVER) == 0) {
+					msg_struct_fill_lua_table(L, *chan, scratch->buf, msg_idx);
+				}
+				zbus_scratch_release(scratch);
+				lua_pop(L, 1);
+			}
+
+			if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+				/* The semaphore was reset for the whole pass */
+				if (loop_pending(loop)) {
+					k_sem_give(&loop->sem);
+				}
+				return lua_error(L);
+			}
+			lua_settop(L, 2);
+			dispatched++;
+		}
+	}
+
+	lua_pushinteger(L, dispatched);
+
+	return 1;
+}
+
+#endif /* CONFIG_LUA_ZBUS_LISTEN */
+
+/**
+ * @brief Lua function: zbus.channel_declare(name) -> channel userdata.
+ *
+ * Also binds the channel's message descriptor to the state so the first
+ * conversion does not pay for interning the field names.
+ */
 static int zbus_channel_declare(lua_State *L)
 {
 	const char *name = luaL_checkstring(L, 1);
@@ -289,10 +1270,13 @@ static int zbus_channel_declare(lua_State *L)
 		return luaL_error(L, "zbus channel '%s' not found", name);
 	}
 
-	const struct zbus_channel **ud = lua_newuserdata(L, sizeof(const struct zbus_channel *));
-	*ud = chan;
-	luaL_getmetatable(L, ZBUS_CHAN_METATABLE);
-	lua_setmetatable(L, -2);
+	const struct lua_msg_descr *descr = zbus_chan_user_data(chan);
+
+	if (descr != NULL) {
+		lua_msg_descr_bind(L, descr->fields, descr->field_count);
+	}
+
+	push_zbus_channel(L, chan);
 
 	return 1;
 }
@@ -338,29 +1322,51 @@ static int zbus_observer_declare(lua_State *L)
 static const luaL_Reg zbus[] = {
 	{"channel_declare", zbus_channel_declare},
 	{"observer_declare", zbus_observer_declare},
+#ifdef CONFIG_LUA_ZBUS_LISTEN
+	{"listen", zbus_listen},
+#endif
 	{NULL, NULL},
 };
 
-/** @brief Open the `zbus` Lua library. Creates channel and observer metatables. */
+/**
+ * @brief Open the `zbus` Lua library.
+ *
+ * Creates the channel, observer and view metatables, the per-state
+ * message scratch buffer used by every pub/read/wait call and the channel
+ * userdata cache.
+ */
 int luaopen_zbus(lua_State *L)
 {
+	/* Sized once for the largest channel; anchored in the registry */
+	struct zbus_scratch *scratch =
+		lua_newuserdatauv(L, sizeof(*scratch) + max_chan_msg_size, 0);
+
+	scratch->busy = false;
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &zbus_scratch_key);
+
+	lua_newtable(L);
+	lua_rawsetp(L, LUA_REGISTRYINDEX, &zbus_chan_cache_key);
+
 	luaL_newmetatable(L, ZBUS_CHAN_METATABLE);
-	/* Duplicate the metatable for setting __index */
-	lua_pushvalue(L, -1);
-	/* Set metatable.__index = metatable */
-	lua_setfield(L, -2, "__index");
-	luaL_setfuncs(L, zbus_chan_metamethods, 0);
+	luaz_rom_setmethods(L, zbus_chan_metamethods);
 	lua_pop(L, 1);
 
 	luaL_newmetatable(L, ZBUS_OBS_METATABLE);
-	/* Duplicate the metatable for setting __index */
-	lua_pushvalue(L, -1);
-	/* Set metatable.__index = metatable */
-	lua_setfield(L, -2, "__index");
-	luaL_setfuncs(L, zbus_obs_metamethods, 0);
+	luaz_rom_setmethods(L, zbus_obs_metamethods);
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, ZBUS_VIEW_METATABLE);
+	luaL_setfuncs(L, zbus_view_metamethods, 0);
+	lua_pop(L, 1);
+
+#ifdef CONFIG_LUA_ZBUS_LISTEN
+	luaL_newmetatable(L, ZBUS_LOOP_METATABLE);
+	lua_pushcfunction(L, loop_gc);
+	lua_setfield(L, -2, "__gc");
 	lua_pop(L, 1);
+#endif
 
-	luaL_newlib(L, zbus);
+	luaz_rom_newlib(L, zbus);
 
 	return 1;
 }